@@ -0,0 +1,15 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#define BENCH_DIR			"BENCH"
+#define BENCH_FILE_SIZE		(1024UL * 1024UL)												// Bytes per sequential pass
+#define BENCH_MAX_REQUEST	32768															// Largest f_write / f_read request; the whole buffer is static RAM
+#define BENCH_RANDOM_OPS	500																// Operations per random IOPS test
+#define BENCH_META_OPS		50																// Iterations per f_open / f_sync / f_close test
+#define BENCH_FILL_STEP		(4UL * 1024UL * 1024UL)											// Bytes allocated per fill step
+#define BENCH_FILL_STEPS	64																// Fill steps before giving up on a large card
+#define BENCH_LOOP_RUNS		100																// Repetitions per CPU loop timing
+
+void Bench_Run(void);
+
+#endif
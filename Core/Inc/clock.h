@@ -0,0 +1,44 @@
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+#include <stdint.h>
+
+// 16 MHz HSI / 8 * 180 / 2 = 180 MHz SYSCLK; AHB /1, APB1 /4 (45 MHz), APB2 /2 (90 MHz)
+#define CLOCK_PLLM			8
+#define CLOCK_PLLN			180
+#define CLOCK_PLLP			2
+#define CLOCK_PLLQ			2
+#define CLOCK_PLLR			2
+#define CLOCK_FLASH_LATENCY	5																// Wait states for 180 MHz at 2.7-3.6 V
+
+#ifndef CLOCK_ART_ENABLE
+#define CLOCK_ART_ENABLE	1																// Prefetch, I-cache and D-cache; 0 runs straight from flash for comparison
+#endif
+
+#ifndef CLOCK_RAMFUNC_ENABLE
+#define CLOCK_RAMFUNC_ENABLE	1															// 0 leaves RAMFUNC code in flash
+#endif
+
+// Functions marked RAMFUNC land in .RamFunc, which the linker script places in .data so the startup
+// code copies them to SRAM with the initialised data; calls across flash and SRAM go through ld veneers
+#if CLOCK_RAMFUNC_ENABLE && !defined(HOST_BUILD)
+#define RAMFUNC				__attribute__((section(".RamFunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+typedef struct {
+	uint32_t sysclk;
+	uint32_t hclk;
+	uint32_t pclk1;
+	uint32_t pclk2;
+} Clock_Info;
+
+void Clock_Init(void);
+void Clock_GetInfo(Clock_Info*);
+uint32_t Clock_GetPCLK1(void);
+uint32_t Clock_GetPCLK2(void);
+uint16_t Clock_USARTBRR(uint32_t, uint32_t);
+uint8_t Clock_SPIPrescaler(uint32_t, uint32_t);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+
+#include <stdint.h>
+#include "fmt.h"
+
+#define CONSOLE_BAUDRATE		921600
+#define CONSOLE_BUFFER_SIZE		2048														// Power of two
+
+#define CONSOLE_LEVEL_NONE		0
+#define CONSOLE_LEVEL_ERROR		1
+#define CONSOLE_LEVEL_INFO		2
+#define CONSOLE_LEVEL_DEBUG		3
+#define CONSOLE_LEVEL_TRACE		4															// Per-sector and per-command traces
+
+#ifndef CONSOLE_LEVEL
+#define CONSOLE_LEVEL			CONSOLE_LEVEL_INFO
+#endif
+
+// Messages above CONSOLE_LEVEL are removed at compile time, arguments included; the rest go through fmt.c, never the heap
+#if CONSOLE_LEVEL >= CONSOLE_LEVEL_ERROR
+#define CON_ERROR(...)			Fmt_Printf(__VA_ARGS__)
+#else
+#define CON_ERROR(...)			((void)0)
+#endif
+
+#if CONSOLE_LEVEL >= CONSOLE_LEVEL_INFO
+#define CON_INFO(...)			Fmt_Printf(__VA_ARGS__)
+#else
+#define CON_INFO(...)			((void)0)
+#endif
+
+#if CONSOLE_LEVEL >= CONSOLE_LEVEL_DEBUG
+#define CON_DEBUG(...)			Fmt_Printf(__VA_ARGS__)
+#else
+#define CON_DEBUG(...)			((void)0)
+#endif
+
+#if CONSOLE_LEVEL >= CONSOLE_LEVEL_TRACE
+#define CON_TRACE(...)			Fmt_Printf(__VA_ARGS__)
+#else
+#define CON_TRACE(...)			((void)0)
+#endif
+
+void Console_Init(void);
+int Console_Putc(int);
+uint32_t Console_Drops(void);
+int Console_GetChar(void);
+void Console_TxComplete(void);
+
+#endif
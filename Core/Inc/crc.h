@@ -0,0 +1,18 @@
+#ifndef __CRC_H
+#define __CRC_H
+
+#include <stdint.h>
+
+// CRC calculation unit fed by DMA2 Stream1 in memory-to-memory mode. The result is CRC-32/MPEG-2
+// over little endian words, the same sum as Rec_CRC32. Thread context only: a handler that nests inside
+// Crc_Compute resets the unit under it, so producers leave sealing to Log_Service (see REC_CRC).
+// Crc_Compute spins until the transfer completes, so the CPU is busy for it either way: it is quicker
+// than Rec_CRC32 (bench crc32_dma), and only a caller with work between Crc_Start and Crc_Wait gains more.
+#define CRC_DMA_MIN_WORDS	16																// Shorter or unaligned buffers are fed by the CPU
+
+void Crc_Init(void);
+void Crc_Start(const uint8_t*, uint32_t);
+uint8_t Crc_Wait(uint32_t*);
+uint32_t Crc_Compute(const uint8_t*, uint32_t);
+
+#endif
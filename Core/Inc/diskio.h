@@ -32,6 +32,31 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+/* FAT, directory, FSInfo and VBR sectors; FatFs routes its window through these */
+DRESULT disk_read_meta (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
+DRESULT disk_write_meta (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
+
+
+/* Metadata sector cache in diskio.c */
+
+#ifndef DISK_CACHE_SECTORS
+#define DISK_CACHE_SECTORS	8	/* Cached sectors, 512 bytes of RAM each; 0 disables the cache */
+#endif
+#ifndef DISK_CACHE_WRITEBACK
+#define DISK_CACHE_WRITEBACK	1	/* 1: metadata writes stay in RAM until CTRL_SYNC or eviction, 0: write-through */
+#endif
+
+typedef struct {
+	DWORD hits;			/* Metadata reads served from RAM */
+	DWORD misses;		/* Metadata reads that went to the card */
+	DWORD absorbed;		/* Metadata writes that replaced a dirty sector without touching the card */
+	DWORD writebacks;	/* Dirty sectors written out at sync or eviction */
+	DWORD evictions;	/* Valid sectors dropped to make room */
+} DCACHE_STATS;
+
+void disk_cache_stats (DCACHE_STATS* stats);
+void disk_cache_reset_stats (void);
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -152,6 +152,11 @@ typedef struct {
 #if !FF_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster (Unknown if >= n_fatent) */
 	DWORD	free_clst;		/* Number of free clusters (Unknown if >= n_fatent-2) */
+#if FF_USE_FREEMAP
+	BYTE	fm_shift;		/* Clusters per free map bit (log2) */
+	BYTE	fm_full;		/* Free map was built by a full FAT scan */
+	BYTE	freemap[FF_FREEMAP_SIZE];	/* Bit set: no free cluster in the group */
+#endif
 #endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -401,6 +406,7 @@ void ff_mutex_give (int vol);		/* Unlock sync object */
 
 /* Fast seek controls (2nd argument of f_lseek function) */
 #define CREATE_LINKMAP	((FSIZE_t)0 - 1)
+#define EXTEND_LINKMAP	((FSIZE_t)0 - 2)
 
 /* Format options (2nd argument of f_mkfs function) */
 #define FM_FAT		0x01
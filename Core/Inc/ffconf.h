@@ -30,15 +30,27 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
-#define FF_USE_MKFS		0
+#define FF_USE_MKFS		1
 /* This option switches f_mkfs(). (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FREEMAP	1
+#define FF_FREEMAP_SIZE	1024
+/* FF_USE_FREEMAP keeps a summary of the FAT in the filesystem object so that
+/  create_chain() skips cluster groups known to have no free cluster instead of
+/  reading their FAT sectors. Each bit covers 2^n clusters, n chosen at mount so the
+/  map fits in FF_FREEMAP_SIZE bytes (1024 bytes is one bit per 32 clusters on a 32GB
+/  card with 32KB clusters). A set bit means the group is full; bits are set by the
+/  allocation scan and by f_getfree() and cleared when a cluster in the group is
+/  freed. Not used on exFAT volumes, which have their own allocation bitmap.
+/  (0:Disable or 1:Enable) */
+
+
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand(). (0:Disable or 1:Enable) */
 
 
@@ -84,7 +96,7 @@
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
 
-#define FF_CODE_PAGE	932
+#define FF_CODE_PAGE	437
 /* This option specifies the OEM code page to be used on the target system.
 /  Incorrect code page setting can cause a file open failure.
 /
@@ -113,7 +125,7 @@
 */
 
 
-#define FF_USE_LFN		0
+#define FF_USE_LFN		1
 #define FF_MAX_LFN		255
 /* The FF_USE_LFN switches the support for LFN (long file name).
 /
@@ -203,14 +215,16 @@
 /  GET_SECTOR_SIZE command. */
 
 
-#define FF_LBA64		0
+#define FF_LBA64		1
 /* This option switches support for 64-bit LBA. (0:Disable or 1:Enable)
 /  To enable the 64-bit LBA, also exFAT needs to be enabled. (FF_FS_EXFAT == 1) */
 
 
-#define FF_MIN_GPT		0x10000000
+#define FF_MIN_GPT		0x100000000
 /* Minimum number of sectors to switch GPT as partitioning format in f_mkfs() and 
-/  f_fdisk(). 2^32 sectors maximum. This option has no effect when FF_LBA64 == 0. */
+/  f_fdisk(). 2^32 sectors maximum. This option has no effect when FF_LBA64 == 0.
+/  Set to the maximum so SD cards, 2 TB at most, keep the MBR the SD file system
+/  specification requires. */
 
 
 #define FF_USE_TRIM		0
@@ -231,7 +245,7 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
-#define FF_FS_EXFAT		0
+#define FF_FS_EXFAT		1
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
 /  Note that enabling exFAT discards ANSI C (C89) compatibility. */
@@ -0,0 +1,18 @@
+#ifndef __FMT_H
+#define __FMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+// Subset of printf understood by Fmt_*: %d %i %u %x %X %c %s %%, flags '-' and '0', a field width,
+// and the 'l' / 'll' length modifiers. 'l' is 32 bits as on the target; no floats, no precision.
+// Nothing here allocates; stack use is fixed and small.
+
+typedef void (*Fmt_Sink)(void* ctx, char c);
+
+int Fmt_Format(Fmt_Sink, void*, const char*, va_list);
+int Fmt_Printf(const char*, ...) __attribute__((format(printf, 1, 2)));
+int Fmt_Snprintf(char*, size_t, const char*, ...) __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef __LOGGER_H
+#define __LOGGER_H
+
+#include <stdint.h>
+#include "ff.h"
+#include "diskio.h"
+
+#define LOG_RING_SIZE		16384															// Power of two; sized against card latency spikes
+#define LOG_CHUNK_SIZE		4096															// Bytes per f_write; whole sectors, divides the cluster size
+#define LOG_STALL_MS		20																// An f_write slower than this counts as a stall
+
+#ifndef LOG_COMPRESS
+#define LOG_COMPRESS		1																// 0 removes the compression stage and its 10 KB of buffers
+#endif
+
+// Spill: while the card is busy, Log_Service does not wait on it; once the ring holds LOG_SPILL_HIGH bytes
+// and the card has been busy for LOG_SPILL_BUSY_MS, far beyond a normal block program, it moves them into
+// the internal flash area of spill.h down to LOG_SPILL_LOW. Spilled bytes are older than
+// anything in the ring and are written out first once the card is ready. The area is erased when a log is
+// opened, and by Log_Service, Log_Flush or Log_Close once it is empty and past LOG_SPILL_RECLAIM; an erase
+// stalls every handler running from flash for 1-2 s, which is why it waits for that point.
+#ifndef LOG_SPILL
+#define LOG_SPILL			1																// 0 removes the spill path and the flash driver calls
+#endif
+#define LOG_SPILL_HIGH		(LOG_RING_SIZE / 2)
+#define LOG_SPILL_LOW		(LOG_RING_SIZE / 4)
+#define LOG_SPILL_BUSY_MS	10
+#define LOG_SPILL_STEP		256																// Bytes copied out of the ring per Spill_Program call
+#define LOG_SPILL_RECLAIM	(SPILL_SIZE / 2)												// Used bytes past which an empty area is erased
+
+// Journal mode: the extent is written as self-checking sectors, so data is durable as soon as its
+// sector is on the card and the directory entry is only rewritten every LOG_JOURNAL_COMMIT_MS.
+// Log_RecoverJournal finds the sectors written after the last commit and fixes the size at mount.
+#define LOG_JOURNAL_MAGIC	0x4E4A															// "JN"
+#define LOG_JOURNAL_HDR		16																// Magic, used bytes, epoch, sequence, extent
+#define LOG_JOURNAL_DATA	(512 - LOG_JOURNAL_HDR - 4)										// Payload bytes; REC_CRC over the rest in the last word
+#define LOG_JOURNAL_FLUSH_MS	1000														// Oldest a partial sector may wait in the ring
+#define LOG_JOURNAL_COMMIT_MS	30000														// Shortest directory entry refresh; recovery covers the gap
+
+// Sync scheduler defaults; see Log_SyncPolicy
+#define LOG_SYNC_BYTES		(256UL * 1024UL)
+#define LOG_SYNC_MS			2000
+#define LOG_SYNC_GRACE_MS	500
+#define LOG_SYNC_IDLE		(LOG_RING_SIZE / 16)
+#define LOG_SYNC_PRESSURE	(LOG_RING_SIZE / 2)
+#define LOG_SYNC_COST_MS	15
+#define LOG_SYNC_MAX_SCALE	8
+
+typedef struct {
+	uint16_t used;																			// Payload bytes, LOG_JOURNAL_DATA except where flushed early
+	uint32_t epoch;																			// Per file; stale sectors of an older journal never match
+	uint32_t seq;																			// Sector index in the file
+	uint32_t extent;																		// Sectors reserved for the journal
+} Log_JournalHdr;
+
+typedef struct {
+	uint32_t committed;																		// Sectors the directory entry covered
+	uint32_t recovered;																		// Valid sectors found after them
+	uint32_t bytes;																			// Payload bytes in the recovered sectors; the committed ones are not read
+} Log_Recovery;
+
+// Log_Service calls f_sync on the first of: bytes written since the last sync, time since the first
+// unsynced byte, or a drained ring with a quarter of the byte budget pending (the stall is free then).
+// A due sync waits up to graceMs while the card is still programming or the ring is above pressure.
+// Each sync is timed; one slower than costMs doubles the byte and time limits up to maxScale, one
+// under half of it halves them again. Journal mode only uses the interval, at least LOG_JOURNAL_COMMIT_MS.
+typedef struct {
+	uint32_t bytes;																			// 0 disables the byte and drained-ring triggers
+	uint32_t intervalMs;
+	uint32_t graceMs;
+	uint32_t idle;																			// Ring bytes at or below which the ring counts as drained
+	uint32_t pressure;
+	uint32_t costMs;
+	uint8_t maxScale;
+} Log_SyncPolicy;
+
+typedef struct {
+	uint32_t highWater;																		// Most bytes ever waiting in the ring
+	uint32_t drops;																			// Records rejected because the ring was full
+	uint32_t dropBytes;
+	uint32_t stalls;																		// f_write calls slower than LOG_STALL_MS
+	uint32_t maxWriteMs;
+	uint32_t written;																		// Bytes handed to f_write
+	uint32_t writeMs;																		// Total time in f_write
+	uint32_t frames;																		// Compressed mode: frames written
+	uint32_t rawFrames;																		// Frames stored because they did not shrink
+	uint32_t frameIn;																		// Ring bytes that went into frames
+	uint64_t frameCycles;																	// Time spent compressing, in profile ticks
+	uint32_t commits;																		// f_sync calls, from the scheduler or Log_Flush
+	uint32_t syncDeferred;																	// Due syncs that waited for an idle card or a calmer ring
+	uint32_t syncMsLast;
+	uint32_t syncMsMax;
+	uint32_t syncMsTotal;																	// Mean is syncMsTotal / commits
+	uint32_t syncScale;																		// Current back-off factor
+	uint32_t spilled;																		// Bytes moved to the flash spill area
+	uint32_t spillMax;																		// Most bytes ever held there
+	uint32_t spillFull;																		// Times the area ran out while the card was busy
+	uint32_t spillErases;
+	uint32_t spillErrors;																	// Program or erase failures; spilling stops until the next erase
+} Log_Stats;
+
+FRESULT Log_Open(const char*);
+FRESULT Log_OpenContiguous(const char*, FSIZE_t);
+FRESULT Log_OpenJournal(const char*, FSIZE_t);
+FRESULT Log_RecoverJournal(const char*, Log_Recovery*);
+int Log_CheckJournal(const uint8_t*, Log_JournalHdr*);
+void Log_SetCompression(uint8_t);
+void Log_SetSpill(uint8_t);
+void Log_SetSeal(uint8_t);
+void Log_SetSyncPolicy(const Log_SyncPolicy*);
+uint8_t Log_Push(const void*, uint16_t);
+FRESULT Log_Service(void);
+FRESULT Log_Flush(void);
+FRESULT Log_Close(void);
+FRESULT Log_Suspend(void);
+FRESULT Log_WriteHeader(const void*, uint32_t);
+uint32_t Log_Pending(void);
+void Log_GetStats(Log_Stats*);
+
+#endif
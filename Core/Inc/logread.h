@@ -0,0 +1,20 @@
+#ifndef __LOGREAD_H
+#define __LOGREAD_H
+
+#include <stdint.h>
+#include "ff.h"
+
+typedef struct {
+	uint32_t sectors;																		// Sectors read from the file
+	uint32_t blocks;																		// recfmt blocks that passed the CRC
+	uint32_t bad;																			// Blocks or header with a CRC mismatch
+	uint32_t gaps;																			// Sequence breaks between intact blocks
+	uint32_t frames;																		// LZ frames expanded
+	uint32_t journal;																		// Journal sectors unwrapped
+	uint32_t badFrames;																		// Frames or journal sectors that did not decode; their blocks are lost
+	uint8_t header;																			// The schema sector parsed
+} LogRead_Report;
+
+FRESULT LogRead_Verify(const char*, LogRead_Report*);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __LZ_H
+#define __LZ_H
+
+#include <stdint.h>
+
+// LZ4-style block codec with a 64 KB offset limit and a 2 KB hash table; no state survives a block.
+// Frames wrap one block for the log file: each starts on a sector boundary and is padded to whole
+// sectors, so any frame can be found and decoded on its own.
+#define LZ_HASH_BITS		10
+#define LZ_FRAME_MAGIC		0x5A4C															// "LZ"
+#define LZ_FRAME_HDR		8																// Magic, flags, raw length, data length
+#define LZ_FRAME_RAW		(1 << 0)														// Stored; the block did not shrink
+
+uint16_t LZ_Compress(const uint8_t*, uint16_t, uint8_t*, uint16_t);
+int32_t LZ_Decompress(const uint8_t*, uint16_t, uint8_t*, uint16_t);
+uint16_t LZ_Frame(const uint8_t*, uint16_t, uint8_t*);
+int32_t LZ_Unframe(const uint8_t*, uint32_t, uint8_t*, uint16_t, uint32_t*);
+
+#endif
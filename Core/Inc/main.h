@@ -53,6 +53,7 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
+void Record_Sample(uint8_t, const void*);
 
 /* USER CODE END EFP */
 
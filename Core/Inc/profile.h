@@ -0,0 +1,79 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE		1																// 0 removes every probe and the histogram tables
+#endif
+
+typedef enum {
+	PROF_SD_READ = 0,																		// SD_ReadBlock
+	PROF_SD_READ_MULTI,																		// SD_ReadMultiBlock
+	PROF_SD_WRITE,																			// SD_WriteBlock
+	PROF_SD_WRITE_MULTI,																	// SD_WriteMultiBlock
+	PROF_SD_BUSY,																			// Programming busy, wherever it is waited out
+	PROF_DISK_READ,
+	PROF_DISK_WRITE,
+	PROF_DISK_IOCTL,
+	PROF_F_WRITE,
+	PROF_F_SYNC,
+	PROF_LOG_COMPRESS,																		// LZ_Frame on one logger chunk
+	PROF_LOG_SEAL,																			// Rec_Seal on one block in Log_Service
+	PROF_COUNT
+} Prof_Id;
+
+#define PROF_BUCKETS		32																// Bucket n holds durations of 2^n to 2^(n+1) - 1 cycles
+
+typedef struct {
+	uint32_t count;
+	uint32_t max;
+	uint64_t total;
+	uint32_t bucket[PROF_BUCKETS];
+} Prof_Histogram;
+
+#if PROFILE_ENABLE
+
+#ifdef HOST_BUILD
+uint32_t Host_Cycles(void);																	// Simulated bus time in ns from the card emulator
+#define PROF_NOW()			Host_Cycles()
+#define PROF_CLZ(x)			__builtin_clz(x)
+#define PROF_TICKS_PER_US	1000
+#else
+#include "stm32f4xx.h"
+#define PROF_NOW()			(DWT -> CYCCNT)
+#define PROF_CLZ(x)			__CLZ(x)
+#define PROF_TICKS_PER_US	(SystemCoreClock / 1000000)
+#endif
+
+extern Prof_Histogram profHist[PROF_COUNT];
+
+// Roughly a dozen cycles per probe: one CYCCNT read, one CLZ and a few increments
+static inline void Prof_Record(Prof_Id id, uint32_t cycles) {
+	Prof_Histogram* h = &profHist[id];
+
+	h -> count++;
+	h -> total += cycles;
+	if (cycles > h -> max) h -> max = cycles;
+	h -> bucket[cycles ? (31 - PROF_CLZ(cycles)) : 0]++;
+}
+
+#define PROF_BEGIN(t)		uint32_t t = PROF_NOW()
+#define PROF_END(id, t)		Prof_Record((id), PROF_NOW() - (t))
+
+void Prof_Init(void);
+void Prof_Reset(void);
+void Prof_Dump(void);
+
+#else
+
+#define PROF_BEGIN(t)
+#define PROF_END(id, t)		((void)0)
+
+#define Prof_Init()			((void)0)
+#define Prof_Reset()		((void)0)
+#define Prof_Dump()			((void)0)
+
+#endif
+
+#endif
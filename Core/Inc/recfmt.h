@@ -0,0 +1,97 @@
+#ifndef __RECFMT_H
+#define __RECFMT_H
+
+#include <stdint.h>
+
+// File layout: one header sector with the channel schema, then REC_BLOCK_SIZE blocks of records.
+// Every sector carries a CRC-32/MPEG-2 over its first 508 bytes taken as little endian words,
+// the same sum the STM32 CRC unit produces. All fields are little endian.
+#define REC_BLOCK_SIZE		512
+#define REC_FILE_MAGIC		0x474F4C53														// "SLOG"
+#define REC_BLOCK_MAGIC		0x4B42															// "BK"
+#define REC_VERSION			1
+#define REC_MAX_CHANNELS	16
+#define REC_NAME_LEN		12
+#define REC_UNIT_LEN		8
+
+#define REC_HDR_SIZE		16																// Block header; payload follows
+#define REC_PAYLOAD_SIZE	(REC_BLOCK_SIZE - REC_HDR_SIZE - 4)
+#define REC_FLAG_PADDED		(1 << 0)														// Sealed early by Rec_Flush
+
+#ifndef REC_HW_CRC
+#ifdef HOST_BUILD
+#define REC_HW_CRC			0
+#else
+#define REC_HW_CRC			1																// Seal and check with the CRC unit (crc.c); Crc_Init first
+#endif
+#endif
+
+typedef enum {
+	REC_I8 = 0,
+	REC_U8,
+	REC_I16,
+	REC_U16,
+	REC_I32,
+	REC_U32,
+	REC_F32,
+	REC_TYPES
+} Rec_Type;
+
+typedef struct {
+	char name[REC_NAME_LEN];																// Not necessarily terminated
+	char unit[REC_UNIT_LEN];
+	uint8_t type;																			// Rec_Type
+} Rec_Channel;
+
+typedef uint8_t (*Rec_Output)(const void*, uint16_t);										// Log_Push; nonzero when the bytes were dropped
+
+typedef struct {
+	const Rec_Channel* channels;
+	uint8_t count;
+	uint32_t tickHz;																		// Timestamp units per second
+	Rec_Output output;
+	uint32_t seq;																			// Next block sequence number
+	uint32_t last;																			// Timestamp of the previous record in the block
+	uint16_t fill;																			// Payload bytes used
+	uint16_t records;
+	uint32_t dropped;																		// Blocks the output refused
+	uint8_t deferSeal;																		// Blocks go out without their CRC; see Rec_DeferSeal
+	uint8_t block[REC_BLOCK_SIZE];
+} Rec_Encoder;
+
+// Channel schema decoded from a file header
+typedef struct {
+	uint16_t version;
+	uint8_t count;
+	uint32_t tickHz;
+	Rec_Channel channels[REC_MAX_CHANNELS];
+} Rec_Schema;
+
+typedef void (*Rec_Sink)(void*, uint32_t, uint8_t, const uint8_t*);							// Context, timestamp, channel, little endian value
+
+extern const uint8_t recTypeSize[REC_TYPES];
+
+uint32_t Rec_CRC32(const uint8_t*, uint32_t);
+
+// Sector checksum for everything that seals 512-byte units (recfmt blocks, journal sectors). Producers
+// leave sealing to the writer (Rec_DeferSeal, Log_SetSeal); anything that still seals inside a handler
+// takes the software sum, so the CRC unit is only ever used from thread context.
+#if REC_HW_CRC
+#include "main.h"
+#include "crc.h"
+#define REC_CRC(data, words)	(__get_IPSR() ? Rec_CRC32((data), (words)) : Crc_Compute((data), (words)))
+#else
+#define REC_CRC(data, words)	Rec_CRC32((data), (words))
+#endif
+void Rec_Seal(uint8_t*);
+void Rec_Begin(Rec_Encoder*, const Rec_Channel*, uint8_t, uint32_t, Rec_Output);
+void Rec_DeferSeal(Rec_Encoder*);
+void Rec_BuildHeader(const Rec_Encoder*, uint8_t*);
+uint8_t Rec_WriteHeader(Rec_Encoder*);
+uint8_t Rec_Add(Rec_Encoder*, uint32_t, uint8_t, const void*);
+uint8_t Rec_Flush(Rec_Encoder*);
+int Rec_ParseHeader(const uint8_t*, Rec_Schema*);
+int Rec_CheckBlock(const uint8_t*, uint32_t*);
+int Rec_DecodeBlock(const Rec_Schema*, const uint8_t*, Rec_Sink, void*);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __SD_SPI_H
+#define __SD_SPI_H
+
+#include <stdint.h>
+
+#define SD_INIT_CLOCK		400000															// Identification mode limit
+#define SD_BUSY_ERROR		0xFE															// Card still programming a write after the 500 ms busy limit
+
+uint8_t SD_Init(void);
+uint8_t SD_Select(void);
+void SD_Deselect(void);
+void SD_PowerUp(void);
+uint8_t SD_SendCMD0(void);
+uint8_t SD_SendCMD8(void);
+uint8_t SD_SendCMD58(void);
+uint8_t SD_SendCMD55(void);
+uint8_t SD_SendACMD41(void);
+uint8_t SD_Card_Init(void);
+uint8_t SD_SendCommand(uint8_t, uint32_t);
+uint8_t SD_WaitReady(void);
+uint8_t SD_StopTransmission(void);
+uint16_t SD_CRC16(const uint8_t*, uint16_t);
+uint8_t SD_ReadCSD(uint8_t*);
+uint64_t SD_CSDSectors(const uint8_t*);
+uint8_t SD_ReadStatus(uint8_t*);
+uint32_t SD_AUSectors(const uint8_t*);
+uint32_t SD_MaxClock(const uint8_t*);
+void SD_SetMaxSpeed(void);
+uint8_t SD_SpeedDown(void);
+uint8_t SD_ReadBlock(uint32_t, uint8_t*);
+uint8_t SD_ReadMultiBlock(uint32_t, uint8_t*, uint32_t);
+uint8_t SD_WriteBlock(uint32_t, const uint8_t*);
+uint8_t SD_WriteMultiBlock(uint32_t, const uint8_t*, uint32_t, uint32_t*);
+uint8_t SD_GetWrittenBlocks(uint32_t*);
+uint8_t SD_IsBusy(void);
+uint8_t SD_Sync(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __SEEKMAP_H
+#define __SEEKMAP_H
+
+#include <stdint.h>
+#include "ff.h"
+
+#define SEEKMAP_ITEMS		64																// DWORDs per table; holds (SEEKMAP_ITEMS - 2) / 2 fragments
+
+typedef struct {
+	FIL* fp;
+	DWORD table[SEEKMAP_ITEMS];																// FatFs CLMT; table[0] is the size going in and the used count coming out
+	FSIZE_t mapped;																			// File size the table covers
+	uint8_t valid;
+	uint8_t overflow;																		// Too fragmented for the table; seeks walk the chain
+} Seek_Map;
+
+FRESULT SeekMap_Attach(Seek_Map*, FIL*);
+FRESULT SeekMap_Seek(Seek_Map*, FSIZE_t);
+uint32_t SeekMap_Fragments(const Seek_Map*);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __SPI_H
+#define __SPI_H
+
+#include <stdint.h>
+
+// Port layer under the SD card driver; the host build replaces it with an emulated card
+void SPI_Init(void);
+void SPI_DMA_Init(void);
+uint8_t SPI_Transfer(uint8_t);
+void SPI_Select(void);
+void SPI_Deselect(void);
+void SPI_DMA_Start(const uint8_t*, uint8_t*, uint16_t);
+uint8_t SPI_DMA_Wait(void);
+uint32_t SPI_SetClock(uint32_t);
+uint32_t SPI_SlowDown(void);
+uint32_t SPI_GetClock(void);
+
+#endif
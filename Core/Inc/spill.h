@@ -0,0 +1,15 @@
+#ifndef __SPILL_H
+#define __SPILL_H
+
+#include <stdint.h>
+
+// Overflow area in internal flash for the logger ring. It is memory mapped, so data is read back in
+// place; writes go one 32-bit word at a time (x32 parallelism, 2.7-3.6 V) onto erased 0xFF words only.
+// The host build backs it with a RAM array in Host/host_flash.c.
+#define SPILL_SIZE			(128UL * 1024UL)												// Sector 7; must match the SPILL region in the linker script
+
+const uint8_t* Spill_Data(void);
+uint8_t Spill_Erase(void);
+uint8_t Spill_Program(uint32_t, const uint8_t*, uint32_t);
+
+#endif
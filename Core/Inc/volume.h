@@ -0,0 +1,33 @@
+#ifndef __VOLUME_H
+#define __VOLUME_H
+
+#include <stdint.h>
+#include "ff.h"
+
+// Cluster ceiling. The SD file system specification formats cards up to 32 GB with 32 KB clusters;
+// anything larger only saves FAT traffic that the free map and contiguous logs already avoid.
+#define VOL_CLUSTER_MAX		32768
+
+// exFAT above 32 GB (SDXC), with the specification's 128 KB cluster up to 512 GB. A contiguous
+// file on exFAT has no FAT chain at all, only its allocation bitmap bits and directory entry.
+#define VOL_EXFAT_SECTORS		0x4000000UL													// 32 GiB
+#define VOL_EXFAT_CLUSTER_MAX	131072
+
+#ifndef VOL_REFORMAT_MISALIGNED
+#define VOL_REFORMAT_MISALIGNED	0															// 1: main() reformats a card whose layout ignores the AU, losing its files
+#endif
+
+typedef struct {
+	LBA_t sectors;																			// Card capacity from the CSD
+	DWORD block;																			// GET_BLOCK_SIZE: the AU, or 1 when the card did not report one
+	DWORD cluster;																			// Bytes
+	LBA_t base;																				// Volume start
+	LBA_t fat;
+	LBA_t data;																				// First cluster; the cluster heap on exFAT
+	uint8_t aligned;																		// base and data on block boundaries; FAT32 also puts fat on one
+} Vol_Layout;
+
+FRESULT Vol_Format(const TCHAR*, void*, UINT);
+FRESULT Vol_GetLayout(FATFS*, Vol_Layout*);
+
+#endif
@@ -0,0 +1,226 @@
+// Storage benchmark suite for the Benchmark build configuration; results go out as CSV on the console
+// Every line is "test,parameter,count,value,unit" so runs on different cards and clocks can be diffed directly.
+#include "main.h"
+#include <string.h>
+#include "ff.h"
+#include "console.h"
+#include "clock.h"
+#include "spi.h"
+#include "sd_spi.h"
+#include "crc.h"
+#include "recfmt.h"
+#include "bench.h"
+
+#ifdef BENCHMARK
+
+// 32 KB of the 128 KB SRAM. The logger, disk cache and console buffers (about 40 KB) are still linked into this
+// build, so a 64 KB request buffer would leave too little for the stack and FatFs objects.
+static uint8_t benchBuffer[BENCH_MAX_REQUEST];
+static uint32_t benchSeed = 0x2545F491;
+extern const char __ramfunc_start[], __ramfunc_end[];									// STM32F446RETX_FLASH.ld
+
+static uint32_t Bench_Random() {
+	benchSeed ^= benchSeed << 13;															// xorshift32
+	benchSeed ^= benchSeed >> 17;
+	benchSeed ^= benchSeed << 5;
+	return benchSeed;
+}
+
+static uint32_t Bench_Cycles() {
+	return DWT -> CYCCNT;
+}
+
+static uint32_t Bench_Us(uint32_t cycles) {
+	return cycles / (SystemCoreClock / 1000000);
+}
+
+// Throughput in kB/s from bytes and milliseconds, rounded down
+static uint32_t Bench_KBps(uint32_t bytes, uint32_t ms) {
+	if (ms == 0) ms = 1;
+	return (uint32_t)(((uint64_t)bytes * 1000) / ((uint64_t)ms * 1024));
+}
+
+// Cycle cost of the byte loops that CLOCK_ART_ENABLE and CLOCK_RAMFUNC_ENABLE target; the card is
+// deselected so the SPI bytes are just idle clocks. Build with either flag at 0 for the before figures.
+// The CRC-32 pair compares the software reference with the DMA-fed unit on one recfmt block.
+static void Bench_CoreLoops() {
+	uint32_t start, elapsed;
+
+	Fmt_Printf("flash_acr,0,1,%lu,reg\r\n", FLASH -> ACR);
+	Fmt_Printf("ramfunc,%lu,1,%lu,bytes\r\n", (uint32_t)CLOCK_RAMFUNC_ENABLE, (uint32_t)(__ramfunc_end - __ramfunc_start));
+
+	SPI_Deselect();
+	start = Bench_Cycles();
+	for (uint32_t i = 0; i < 512; i++) SPI_Transfer(0xFF);
+	elapsed = Bench_Cycles() - start;
+	Fmt_Printf("spi_transfer,%lu,512,%lu,cycles\r\n", SPI_GetClock(), elapsed);
+
+	start = Bench_Cycles();
+	for (uint32_t i = 0; i < BENCH_LOOP_RUNS; i++) SD_CRC16(benchBuffer, 512);
+	elapsed = Bench_Cycles() - start;
+	Fmt_Printf("crc16,512,%d,%lu,cycles\r\n", BENCH_LOOP_RUNS, elapsed / BENCH_LOOP_RUNS);
+
+	uint32_t soft = Rec_CRC32(benchBuffer, 127);
+	start = Bench_Cycles();
+	for (uint32_t i = 0; i < BENCH_LOOP_RUNS; i++) Rec_CRC32(benchBuffer, 127);
+	elapsed = Bench_Cycles() - start;
+	Fmt_Printf("crc32_soft,508,%d,%lu,cycles\r\n", BENCH_LOOP_RUNS, elapsed / BENCH_LOOP_RUNS);
+
+	uint32_t hard = Crc_Compute(benchBuffer, 127);
+	start = Bench_Cycles();
+	for (uint32_t i = 0; i < BENCH_LOOP_RUNS; i++) Crc_Compute(benchBuffer, 127);
+	elapsed = Bench_Cycles() - start;
+	Fmt_Printf("crc32_dma,508,%d,%lu,cycles\r\n", BENCH_LOOP_RUNS, elapsed / BENCH_LOOP_RUNS);
+	Fmt_Printf("crc32_match,0,1,%d,-\r\n", soft == hard);
+}
+
+// Sequential write then read of BENCH_FILE_SIZE bytes for each request size from 512 B to BENCH_MAX_REQUEST
+// Only the transfer loop is timed; f_open and f_close show up in Bench_Metadata instead.
+static void Bench_Sequential() {
+	FIL file;
+	UINT done;
+
+	for (uint32_t size = 512; size <= BENCH_MAX_REQUEST; size <<= 1) {
+		if (f_open(&file, BENCH_DIR "/SEQ.BIN", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return;
+		uint32_t start = HAL_GetTick();
+		for (uint32_t pos = 0; pos < BENCH_FILE_SIZE; pos += size) {
+			if (f_write(&file, benchBuffer, size, &done) != FR_OK || done != size) break;
+		}
+		uint32_t elapsed = HAL_GetTick() - start;
+		f_close(&file);
+		Fmt_Printf("seq_write,%lu,%lu,%lu,kB/s\r\n", size, BENCH_FILE_SIZE, Bench_KBps(BENCH_FILE_SIZE, elapsed));
+
+		if (f_open(&file, BENCH_DIR "/SEQ.BIN", FA_READ) != FR_OK) return;
+		start = HAL_GetTick();
+		for (uint32_t pos = 0; pos < BENCH_FILE_SIZE; pos += size) {
+			if (f_read(&file, benchBuffer, size, &done) != FR_OK || done != size) break;
+		}
+		elapsed = HAL_GetTick() - start;
+		f_close(&file);
+		Fmt_Printf("seq_read,%lu,%lu,%lu,kB/s\r\n", size, BENCH_FILE_SIZE, Bench_KBps(BENCH_FILE_SIZE, elapsed));
+	}
+}
+
+// Random 512 B reads and writes at sector aligned offsets inside the sequential test file
+static void Bench_Random512() {
+	FIL file;
+	UINT done;
+	uint32_t sectors = BENCH_FILE_SIZE / 512;
+
+	if (f_open(&file, BENCH_DIR "/SEQ.BIN", FA_READ | FA_WRITE) != FR_OK) return;
+
+	uint32_t start = HAL_GetTick();
+	for (int i = 0; i < BENCH_RANDOM_OPS; i++) {
+		f_lseek(&file, (Bench_Random() % sectors) * 512);
+		f_read(&file, benchBuffer, 512, &done);
+	}
+	uint32_t elapsed = HAL_GetTick() - start;
+	Fmt_Printf("rand_read,512,%d,%lu,IOPS\r\n", BENCH_RANDOM_OPS, (BENCH_RANDOM_OPS * 1000UL) / (elapsed ? elapsed : 1));
+
+	start = HAL_GetTick();
+	for (int i = 0; i < BENCH_RANDOM_OPS; i++) {
+		f_lseek(&file, (Bench_Random() % sectors) * 512);
+		f_write(&file, benchBuffer, 512, &done);
+	}
+	f_sync(&file);																			// The last sector is still in the file buffer
+	elapsed = HAL_GetTick() - start;
+	Fmt_Printf("rand_write,512,%d,%lu,IOPS\r\n", BENCH_RANDOM_OPS, (BENCH_RANDOM_OPS * 1000UL) / (elapsed ? elapsed : 1));
+
+	f_close(&file);
+}
+
+// Mean and worst case of f_open, f_sync after a small append, and f_close
+static void Bench_Metadata() {
+	FIL file;
+	UINT done;
+	uint32_t total[3] = {0, 0, 0};
+	uint32_t worst[3] = {0, 0, 0};
+	static const char* const names[3] = {"f_open", "f_sync", "f_close"};
+
+	for (int i = 0; i < BENCH_META_OPS; i++) {
+		uint32_t t[3];
+
+		uint32_t start = Bench_Cycles();
+		if (f_open(&file, BENCH_DIR "/META.TXT", FA_WRITE | FA_OPEN_APPEND) != FR_OK) return;
+		t[0] = Bench_Cycles() - start;
+
+		f_write(&file, "0123456789ABCDEF", 16, &done);
+
+		start = Bench_Cycles();
+		f_sync(&file);
+		t[1] = Bench_Cycles() - start;
+
+		start = Bench_Cycles();
+		f_close(&file);
+		t[2] = Bench_Cycles() - start;
+
+		for (int k = 0; k < 3; k++) {
+			total[k] += t[k];
+			if (t[k] > worst[k]) worst[k] = t[k];
+		}
+	}
+
+	for (int k = 0; k < 3; k++) {
+		Fmt_Printf("%s_mean,0,%d,%lu,us\r\n", names[k], BENCH_META_OPS, Bench_Us(total[k] / BENCH_META_OPS));
+		Fmt_Printf("%s_max,0,%d,%lu,us\r\n", names[k], BENCH_META_OPS, Bench_Us(worst[k]));
+	}
+}
+
+// Allocates BENCH_FILL_STEP bytes per file by seeking past the end, which walks the FAT without writing data
+static void Bench_Allocation() {
+	FIL file;
+	FATFS* fs;
+	DWORD freeClusters;
+	char name[24];
+	int steps;
+
+	for (steps = 0; steps < BENCH_FILL_STEPS; steps++) {
+		if (f_getfree("", &freeClusters, &fs) != FR_OK) break;
+		if ((uint64_t)freeClusters * fs -> csize * 512 < 2 * BENCH_FILL_STEP) break;
+
+		Fmt_Snprintf(name, sizeof(name), BENCH_DIR "/FILL%03d.BIN", steps);
+		if (f_open(&file, name, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) break;
+
+		uint32_t start = HAL_GetTick();
+		FRESULT fr = f_lseek(&file, BENCH_FILL_STEP);
+		f_close(&file);
+		uint32_t elapsed = HAL_GetTick() - start;
+		if (fr != FR_OK) break;
+
+		uint32_t clusters = BENCH_FILL_STEP / (fs -> csize * 512);
+		Fmt_Printf("alloc,%lu,%lu,%lu,us/cluster\r\n", freeClusters, clusters, (elapsed * 1000) / clusters);
+	}
+
+	while (steps-- > 0) {																	// Leaves the volume as it was found
+		Fmt_Snprintf(name, sizeof(name), BENCH_DIR "/FILL%03d.BIN", steps);
+		f_unlink(name);
+	}
+}
+
+void Bench_Run() {
+	CoreDebug -> DEMCR |= (1 << 24);														// TRCENA
+	DWT -> CTRL |= (1 << 0);																// CYCCNTENA
+
+	for (uint32_t i = 0; i < sizeof(benchBuffer); i++) {
+		benchBuffer[i] = (uint8_t)i;
+	}
+
+	f_mkdir(BENCH_DIR);
+
+	Fmt_Printf("test,parameter,count,value,unit\r\n");
+	Fmt_Printf("sysclk,0,1,%lu,Hz\r\n", SystemCoreClock);
+
+	Bench_CoreLoops();
+	Bench_Sequential();
+	Bench_Random512();
+	Bench_Metadata();
+	Bench_Allocation();
+
+	f_unlink(BENCH_DIR "/SEQ.BIN");
+	f_unlink(BENCH_DIR "/META.TXT");
+
+	Fmt_Printf("console_drops,0,1,%lu,bytes\r\n", Console_Drops());
+	Fmt_Printf("done,0,0,0,-\r\n");
+}
+
+#endif
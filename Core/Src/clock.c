@@ -0,0 +1,89 @@
+// System clock tree bring-up for 180 MHz operation with over-drive, plus the ART accelerator; RM0390 sections 3 and 6
+#include "main.h"
+#include "clock.h"
+
+// Must run before any peripheral whose divider depends on the bus clocks
+void Clock_Init() {
+	RCC -> APB1ENR |= (1 << 28);														// PWR Clock
+	PWR -> CR |= (3 << 14);																// Voltage scale 1, required above 168 MHz
+
+	RCC -> CR |= (1 << 0);																// HSI on; already the reset clock
+	while (!(RCC -> CR & (1 << 1)));
+
+	RCC -> CR &= ~(1 << 24);															// PLL must be off while it is configured
+	while (RCC -> CR & (1 << 25));
+
+	RCC -> PLLCFGR = (CLOCK_PLLM << 0)													// HSI is the PLL source with bit 22 clear
+				   | (CLOCK_PLLN << 6)
+				   | (((CLOCK_PLLP / 2) - 1) << 16)
+				   | (CLOCK_PLLQ << 24)
+				   | (CLOCK_PLLR << 28);
+
+	RCC -> CR |= (1 << 24);																// PLL on
+	while (!(RCC -> CR & (1 << 25)));													// Waits for PLLRDY
+
+	PWR -> CR |= (1 << 16);																// Over-drive enable
+	while (!(PWR -> CSR & (1 << 16)));													// Waits for ODRDY
+	PWR -> CR |= (1 << 17);																// Over-drive switching enable
+	while (!(PWR -> CSR & (1 << 17)));													// Waits for ODSWRDY
+
+	FLASH -> ACR &= ~((1 << 8) | (1 << 9) | (1 << 10));								// Prefetch and caches off; HAL_Init may have enabled them
+	FLASH -> ACR |= (1 << 11) | (1 << 12);												// ICRST & DCRST; only valid with the caches disabled
+	FLASH -> ACR &= ~((1 << 11) | (1 << 12));
+
+	FLASH -> ACR = (FLASH -> ACR & ~(15 << 0)) | (CLOCK_FLASH_LATENCY << 0);			// Wait states before the clock goes up
+	while ((FLASH -> ACR & (15 << 0)) != CLOCK_FLASH_LATENCY);
+
+#if CLOCK_ART_ENABLE
+	FLASH -> ACR |= (1 << 8) | (1 << 9) | (1 << 10);									// PRFTEN, ICEN & DCEN; hides most of the 5 wait states
+#endif
+
+	RCC -> CFGR &= ~((15 << 4) | (7 << 10) | (7 << 13));
+	RCC -> CFGR |= (0 << 4);															// AHB /1
+	RCC -> CFGR |= (5 << 10);															// APB1 /4, 45 MHz maximum
+	RCC -> CFGR |= (4 << 13);															// APB2 /2, 90 MHz maximum
+
+	RCC -> CFGR = (RCC -> CFGR & ~(3 << 0)) | (2 << 0);									// PLL as SYSCLK
+	while (((RCC -> CFGR >> 2) & 3) != 2);												// Waits for SWS
+
+	SystemCoreClockUpdate();
+	HAL_InitTick(TICK_INT_PRIORITY);													// Keeps SysTick at 1 ms on the new clock
+}
+
+// Bus clocks as currently programmed, not as requested
+void Clock_GetInfo(Clock_Info* info) {
+	SystemCoreClockUpdate();
+
+	info -> sysclk = SystemCoreClock;
+	info -> hclk = SystemCoreClock >> AHBPrescTable[(RCC -> CFGR >> 4) & 15];
+	info -> pclk1 = info -> hclk >> APBPrescTable[(RCC -> CFGR >> 10) & 7];
+	info -> pclk2 = info -> hclk >> APBPrescTable[(RCC -> CFGR >> 13) & 7];
+}
+
+uint32_t Clock_GetPCLK1() {
+	Clock_Info info;
+	Clock_GetInfo(&info);
+	return info.pclk1;
+}
+
+uint32_t Clock_GetPCLK2() {
+	Clock_Info info;
+	Clock_GetInfo(&info);
+	return info.pclk2;
+}
+
+// BRR for 16x oversampling; mantissa and fraction together are just fPCLK / baud
+uint16_t Clock_USARTBRR(uint32_t pclk, uint32_t baud) {
+	return (uint16_t)((pclk + (baud / 2)) / baud);
+}
+
+// Smallest BR value with fPCLK / 2^(BR + 1) not above maxHz; 7 (/256) if nothing is slow enough
+uint8_t Clock_SPIPrescaler(uint32_t pclk, uint32_t maxHz) {
+	uint8_t br = 0;
+
+	while (br < 7 && (pclk >> (br + 1)) > maxHz) {
+		br++;
+	}
+
+	return br;
+}
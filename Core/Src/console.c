@@ -0,0 +1,107 @@
+// USART2 console; Fmt_Printf (fmt.c) fills a ring that DMA1 Stream6 Channel 4 drains in the background
+#include "main.h"
+#include "clock.h"
+#include "console.h"
+
+static uint8_t txBuffer[CONSOLE_BUFFER_SIZE];
+static volatile uint32_t txHead;															// Free running; written by Console_Putc
+static volatile uint32_t txTail;															// Free running; advanced when a DMA transfer completes
+static volatile uint32_t txLength;															// Bytes in flight, 0 when the stream is idle
+static volatile uint32_t txDrops;
+
+void Console_Init() {
+	RCC -> APB1ENR |= (1 << 17);															// USART2 Clock
+	RCC -> AHB1ENR |= (1 << 0);																// GPIOA Clock; should be already enabled
+	RCC -> AHB1ENR |= (1 << 21);															// DMA1 Clock
+
+	GPIOA -> MODER &= ~((3 << (2 * 2)) | (3 << (2 * 3)));									// PA2 & PA3 to Alternate Function
+	GPIOA -> MODER |= (2 << (2 * 2)) | (2 << (2 * 3));
+
+	GPIOA -> AFR[0] |= (7 << (4 * 2)) | (7 << (4 * 3));										// Sets alternate function for USART2
+
+	USART2 -> BRR = Clock_USARTBRR(Clock_GetPCLK1(), CONSOLE_BAUDRATE);						// Derived from the actual APB1 clock
+
+	USART2 -> CR1 |= (1 << 2) | (1 << 3);													// Receiver & Transmitter Enabled
+	USART2 -> CR3 |= (1 << 7);																// DMAT; TX requests come from TXE
+	USART2 -> CR1 |= (1 << 13);																// USART2 Enabled
+
+	DMA1_Stream6 -> CR = 0;
+	while (DMA1_Stream6 -> CR & (1 << 0));
+	DMA1_Stream6 -> PAR = (uint32_t)&USART2 -> DR;
+	DMA1_Stream6 -> FCR = 0;																// Direct mode
+
+	txHead = 0;
+	txTail = 0;
+	txLength = 0;
+
+	NVIC_SetPriority(DMA1_Stream6_IRQn, 14);												// Just above SysTick; the console is never urgent
+	NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+}
+
+// Starts a transfer of the contiguous run at tail; caller holds interrupts off
+static void Console_Kick() {
+	uint32_t pending = txHead - txTail;
+	if (txLength != 0 || pending == 0) return;
+
+	uint32_t offset = txTail & (CONSOLE_BUFFER_SIZE - 1);
+	uint32_t length = CONSOLE_BUFFER_SIZE - offset;
+	if (length > pending) length = pending;
+
+	DMA1 -> HIFCR = (0x3D << 16);															// Clears every Stream6 flag
+
+	DMA1_Stream6 -> M0AR = (uint32_t)&txBuffer[offset];
+	DMA1_Stream6 -> NDTR = length;
+	DMA1_Stream6 -> CR = (4 << 25)															// Channel 4
+					   | (1 << 10)															// Memory increment
+					   | (1 << 6)															// Memory to peripheral
+					   | (1 << 4);															// Transfer complete interrupt
+	txLength = length;
+	DMA1_Stream6 -> CR |= (1 << 0);
+}
+
+// Never waits for the UART; characters that do not fit are counted and discarded
+int Console_Putc(int c) {
+	uint32_t h = txHead;
+
+	if ((h - txTail) >= CONSOLE_BUFFER_SIZE) {
+		txDrops++;
+		return c;
+	}
+
+	txBuffer[h & (CONSOLE_BUFFER_SIZE - 1)] = (uint8_t)c;
+	txHead = h + 1;
+
+	if (txLength == 0) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		Console_Kick();
+		__set_PRIMASK(primask);
+	}
+
+	return c;
+}
+
+uint32_t Console_Drops() {
+	return txDrops;
+}
+
+// Non-blocking; -1 when nothing has been received
+int Console_GetChar() {
+	if (!(USART2 -> SR & (1 << 5))) return -1;												// RXNE
+
+	return USART2 -> DR & 0xFF;
+}
+
+// Called from DMA1_Stream6_IRQHandler
+void Console_TxComplete() {
+	if (!(DMA1 -> HISR & ((1 << 21) | (1 << 19)))) return;								// TCIF6 or TEIF6
+
+	DMA1 -> HIFCR = (0x3D << 16);
+	txTail += txLength;
+	txLength = 0;
+	Console_Kick();
+}
+
+int __io_putchar(int c) {
+	return Console_Putc(c);
+}
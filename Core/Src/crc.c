@@ -0,0 +1,86 @@
+// Hardware CRC for log blocks; RM0390 section 11 (CRC) and 9.3.6 (memory-to-memory DMA)
+// Only DMA2 can do memory-to-memory, and its Stream0/Stream3 belong to SPI1, so Stream1 is used here
+// at the lowest priority: SD transfers always win the arbitration.
+#include "main.h"
+#include "crc.h"
+
+static const uint8_t* crcData;																// Kept for the CPU fallback after a DMA error
+static uint32_t crcWords;
+static uint8_t crcDMA;																		// A DMA transfer is in flight
+
+// Word at a time through the data register; data may be unaligned
+static void Crc_Feed(const uint8_t* data, uint32_t words) {
+	for (uint32_t i = 0; i < words; i++, data += 4) {
+		CRC -> DR = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+	}
+}
+
+void Crc_Init() {
+	RCC -> AHB1ENR |= (1 << 12);															// CRC Clock
+	RCC -> AHB1ENR |= (1 << 22);															// DMA2 Clock; shared with SPI1
+
+	DMA2_Stream1 -> CR = 0;
+	while (DMA2_Stream1 -> CR & (1 << 0));
+	DMA2_Stream1 -> M0AR = (uint32_t)&CRC -> DR;											// Destination; the unit folds every word written
+	DMA2_Stream1 -> FCR = (1 << 2) | (3 << 0);												// Memory-to-memory needs FIFO mode; full threshold
+
+	crcDMA = 0;
+}
+
+// Resets the unit and starts on words 32-bit words at data; the CPU is free until Crc_Wait
+void Crc_Start(const uint8_t* data, uint32_t words) {
+	CRC -> CR = (1 << 0);																	// RESET; DR back to 0xFFFFFFFF
+	crcData = data;
+	crcWords = words;
+
+	if (((uint32_t)data & 3) || words < CRC_DMA_MIN_WORDS || words > 0xFFFF) {				// Not worth a DMA set-up, or not possible
+		Crc_Feed(data, words);
+		crcDMA = 0;
+		return;
+	}
+
+	DMA2 -> LIFCR = (0x3D << 6);															// Clears every Stream1 flag
+	DMA2_Stream1 -> PAR = (uint32_t)data;													// Source when the direction is memory-to-memory
+	DMA2_Stream1 -> NDTR = words;
+	DMA2_Stream1 -> CR = (2 << 13)															// 32-bit memory size
+					   | (2 << 11)															// 32-bit peripheral size
+					   | (1 << 9)															// Source increment
+					   | (2 << 6);															// Memory-to-memory; low priority, channel 0
+	crcDMA = 1;
+	DMA2_Stream1 -> CR |= (1 << 0);
+}
+
+// Returns 1 if the DMA failed; crc is still valid then, recomputed by the CPU from the source
+uint8_t Crc_Wait(uint32_t* crc) {
+	uint8_t error = 0;
+
+	if (crcDMA) {
+		while (!(DMA2 -> LISR & (1 << 11))) {												// Waits for TCIF1
+			if (DMA2 -> LISR & (1 << 9)) {													// TEIF1
+				error = 1;
+				break;
+			}
+		}
+
+		DMA2_Stream1 -> CR &= ~(1 << 0);
+		while (DMA2_Stream1 -> CR & (1 << 0));
+		DMA2 -> LIFCR = (0x3D << 6);
+		crcDMA = 0;
+
+		if (error) {																		// Part of the buffer may be folded in already
+			CRC -> CR = (1 << 0);
+			Crc_Feed(crcData, crcWords);
+		}
+	}
+
+	*crc = CRC -> DR;
+	return error;
+}
+
+uint32_t Crc_Compute(const uint8_t* data, uint32_t words) {
+	uint32_t crc;
+
+	Crc_Start(data, words);
+	Crc_Wait(&crc);
+	return crc;
+}
@@ -7,34 +7,195 @@
 /* storage control modules to the FatFs module with a defined API.       */
 /*-----------------------------------------------------------------------*/
 
+#include <string.h>
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
+#include "console.h"
+#include "profile.h"
+#include "sd_spi.h"
 
-extern uint8_t SD_Init(void);
-extern uint8_t SD_ReadBlock(uint32_t, uint8_t*);
-extern uint8_t SD_WriteBlock(uint32_t, const uint8_t*);
 
 /*-----------------------------------------------------------------------*/
 /* Initialize a Drive                                                    */
 /*-----------------------------------------------------------------------*/
 
 static volatile DSTATUS Stat = STA_NOINIT;
+static LBA_t cardSectors;                               // From the CSD; 0 when it could not be read
+static DWORD cardBlock;                                 // Erase block for f_mkfs: the AU, clipped to a power of two
+
+// Driver calls timed under the probe that matches their block count
+static uint8_t SD_Read(LBA_t sector, BYTE* buff, UINT count) {
+    PROF_BEGIN(t);
+    uint8_t res = (count > 1) ? SD_ReadMultiBlock(sector, buff, count)  // One CMD18 stream for the whole run
+                              : SD_ReadBlock(sector, buff);
+    PROF_END((count > 1) ? PROF_SD_READ_MULTI : PROF_SD_READ, t);
+    return res;
+}
+
+static uint8_t SD_Write(LBA_t sector, const BYTE* buff, UINT count, uint32_t* written) {
+    PROF_BEGIN(t);
+    uint8_t res;
+    if (count > 1) {                                    // One CMD25 stream, pre-erased with ACMD23
+        res = SD_WriteMultiBlock(sector, buff, count, written);
+    } else {
+        res = SD_WriteBlock(sector, buff);
+        *written = (res == 0) ? 1 : 0;
+    }
+    PROF_END((count > 1) ? PROF_SD_WRITE_MULTI : PROF_SD_WRITE, t);
+    return res;
+}
+
+// Card transfers behind the cache; reads retry one SPI clock step slower on token timeout or CRC error
+static DRESULT Card_Read(BYTE* buff, LBA_t sector, UINT count) {
+    uint8_t res = SD_Read(sector, buff, count);
+    while (res == 2 || res == 4) {
+        if (!SD_SpeedDown()) break;
+        res = SD_Read(sector, buff, count);
+    }
+    if (res != 0) {
+        CON_ERROR("Read failed at sector %lu, count %u\r\n", (unsigned long)sector, count);
+        return RES_ERROR;
+    }
+
+    CON_TRACE("Read completed successfully\r\n");
+    return RES_OK;
+}
+
+static DRESULT Card_Write(const BYTE* buff, LBA_t sector, UINT count) {
+    uint32_t written;
+    if (SD_Write(sector, buff, count, &written) != 0) {
+        CON_ERROR("Write failed at sector %lu, %lu of %u blocks accepted\r\n", (unsigned long)(sector + written), (unsigned long)written, count);
+        return RES_ERROR;
+    }
+
+    CON_TRACE("Write completed successfully\r\n");
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Metadata Sector Cache                                                 */
+/*-----------------------------------------------------------------------*/
+
+// FatFs keeps one sector window, so FAT and directory sectors are re-read every time the
+// allocation and directory paths alternate. Only sectors FatFs passes through the *_meta
+// calls are cached; file data goes straight to the card but is kept coherent with the lines.
+
+static DCACHE_STATS cacheStats;
+
+#if DISK_CACHE_SECTORS
+
+typedef struct {
+    BYTE data[512];                                     // First, so the buffer stays word aligned
+    LBA_t sector;
+    DWORD used;                                         // LRU stamp; 0 marks an empty line
+    BYTE dirty;
+} Cache_Line;
+
+static Cache_Line cache[DISK_CACHE_SECTORS];
+static DWORD cacheClock;
+
+static Cache_Line* Cache_Find(LBA_t sector) {
+    for (int i = 0; i < DISK_CACHE_SECTORS; i++) {
+        if (cache[i].used && cache[i].sector == sector) return &cache[i];
+    }
+    return NULL;
+}
+
+// An empty line, or else the least recently used one
+static Cache_Line* Cache_Victim(void) {
+    Cache_Line* victim = &cache[0];
+
+    for (int i = 0; i < DISK_CACHE_SECTORS; i++) {
+        if (!cache[i].used) return &cache[i];
+        if (cache[i].used < victim -> used) victim = &cache[i];
+    }
+    return victim;
+}
+
+static DRESULT Cache_Clean(Cache_Line* line) {
+    if (!line -> used || !line -> dirty) return RES_OK;
+
+    if (Card_Write(line -> data, line -> sector, 1) != RES_OK) return RES_ERROR;
+    line -> dirty = 0;
+    cacheStats.writebacks++;
+    return RES_OK;
+}
+
+// Frees a line for sector, writing back whatever it held
+static Cache_Line* Cache_Claim(LBA_t sector) {
+    Cache_Line* line = Cache_Victim();
+
+    if (line -> used) {
+        if (Cache_Clean(line) != RES_OK) return NULL;
+        cacheStats.evictions++;
+    }
+    line -> sector = sector;
+    line -> dirty = 0;
+    line -> used = 0;
+    return line;
+}
+
+static void Cache_Touch(Cache_Line* line) {
+    line -> used = ++cacheClock;
+    if (cacheClock == 0) {                              // Wrapped; restart the stamps keeping nothing but validity
+        for (int i = 0; i < DISK_CACHE_SECTORS; i++) {
+            if (cache[i].used) cache[i].used = 1;
+        }
+        line -> used = cacheClock = 2;
+    }
+}
+
+// Dirty lines in ascending sector order, so FAT runs reach the card as sequential writes
+static DRESULT Cache_Flush(void) {
+    for (;;) {
+        Cache_Line* next = NULL;
+
+        for (int i = 0; i < DISK_CACHE_SECTORS; i++) {
+            if (cache[i].used && cache[i].dirty && (!next || cache[i].sector < next -> sector)) next = &cache[i];
+        }
+        if (!next) return RES_OK;
+        if (Cache_Clean(next) != RES_OK) return RES_ERROR;
+    }
+}
+
+static void Cache_Invalidate(void) {
+    memset(cache, 0, sizeof(cache));
+    cacheClock = 0;
+}
+
+#endif
+
+void disk_cache_stats(DCACHE_STATS* stats) {
+    *stats = cacheStats;
+}
+
+void disk_cache_reset_stats(void) {
+    memset(&cacheStats, 0, sizeof(cacheStats));
+}
 
 // Only using drive 0; SD card only
 DSTATUS disk_initialize(BYTE pdrv) {
     if (pdrv != 0) {
-        printf("Init: Invalid drive number\r\n");
+        CON_ERROR("Init: Invalid drive number\r\n");
         return STA_NOINIT;
     }
 
-    printf("Initializing disk...\r\n");
+    CON_INFO("Initializing disk...\r\n");
     if (SD_Init() == 0) {
-        printf("Disk init successful\r\n");
+        CON_INFO("Disk init successful\r\n");
+        uint8_t reg[64];
+        cardSectors = (SD_ReadCSD(reg) == 0) ? SD_CSDSectors(reg) : 0;
+        DWORD au = (SD_ReadStatus(reg) == 0) ? SD_AUSectors(reg) : 0;
+        for (cardBlock = 1; cardBlock * 2 <= au && au % (cardBlock * 2) == 0 && cardBlock < 0x8000; cardBlock *= 2) ;
+        CON_INFO("Card: %llu sectors, AU %lu sectors\r\n", (unsigned long long)cardSectors, (unsigned long)au);
+#if DISK_CACHE_SECTORS
+        Cache_Invalidate();                             // May be a different card
+#endif
         Stat &= ~STA_NOINIT;
         return 0;
     }
 
-    printf("Disk init failed\r\n");
+    CON_ERROR("Disk init failed\r\n");
     return STA_NOINIT;
 }
 
@@ -48,29 +209,57 @@ DSTATUS disk_status(BYTE pdrv) {
 /*-----------------------------------------------------------------------*/
 
 DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
-    printf("Reading sector %lu, count %u\r\n", sector, count);
+    CON_TRACE("Reading sector %lu, count %u\r\n", (unsigned long)sector, count);
 
     if (pdrv != 0 || !count) {
-        printf("Read: Invalid parameters\r\n");
+        CON_ERROR("Read: Invalid parameters\r\n");
         return RES_PARERR;
     }
     if (Stat & STA_NOINIT) {
-        printf("Read: Disk not initialized\r\n");
+        CON_ERROR("Read: Disk not initialized\r\n");
         return RES_NOTRDY;
     }
 
-    while (count > 0) {
-        printf("Reading sector %lu\r\n", sector);
-        if (SD_ReadBlock(sector, buff) != 0) {
-            printf("Read failed at sector %lu\r\n", sector);
-            return RES_ERROR;
+    PROF_BEGIN(t);
+    DRESULT result = Card_Read(buff, sector, count);
+
+#if DISK_CACHE_SECTORS
+    for (int i = 0; result == RES_OK && i < DISK_CACHE_SECTORS; i++) {
+        if (cache[i].used && cache[i].dirty && cache[i].sector - sector < count) {
+            memcpy(buff + (cache[i].sector - sector) * 512, cache[i].data, 512);     // Newer than the card
         }
-        sector++;
-        buff += 512;
-        count--;
     }
-    printf("Read completed successfully\r\n");
-    return RES_OK;
+#endif
+
+    PROF_END(PROF_DISK_READ, t);
+    return result;
+}
+
+DRESULT disk_read_meta(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
+#if DISK_CACHE_SECTORS
+    if (pdrv != 0 || count != 1 || (Stat & STA_NOINIT)) return disk_read(pdrv, buff, sector, count);
+
+    PROF_BEGIN(t);
+    DRESULT result = RES_OK;
+
+    Cache_Line* line = Cache_Find(sector);
+    if (line) {
+        cacheStats.hits++;
+    } else {
+        cacheStats.misses++;
+        line = Cache_Claim(sector);
+        if (!line || Card_Read(line -> data, sector, 1) != RES_OK) result = RES_ERROR;
+    }
+    if (result == RES_OK) {
+        Cache_Touch(line);
+        memcpy(buff, line -> data, 512);
+    }
+
+    PROF_END(PROF_DISK_READ, t);
+    return result;
+#else
+    return disk_read(pdrv, buff, sector, count);
+#endif
 }
 
 /*-----------------------------------------------------------------------*/
@@ -78,29 +267,67 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
 /*-----------------------------------------------------------------------*/
 
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
-    printf("Writing sector %lu, count %u\r\n", sector, count);
+    CON_TRACE("Writing sector %lu, count %u\r\n", (unsigned long)sector, count);
 
     if (pdrv != 0 || !count) {
-        printf("Write: Invalid parameters\r\n");
+        CON_ERROR("Write: Invalid parameters\r\n");
         return RES_PARERR;
     }
     if (Stat & STA_NOINIT) {
-        printf("Write: Disk not initialized\r\n");
+        CON_ERROR("Write: Disk not initialized\r\n");
         return RES_NOTRDY;
     }
 
-    while (count > 0) {
-        printf("Writing sector %lu\r\n", sector);
-        if (SD_WriteBlock(sector, buff) != 0) {
-            printf("Write failed at sector %lu\r\n", sector);
-            return RES_ERROR;
+    PROF_BEGIN(t);
+    DRESULT result = Card_Write(buff, sector, count);
+
+#if DISK_CACHE_SECTORS
+    for (int i = 0; i < DISK_CACHE_SECTORS; i++) {
+        if (cache[i].used && cache[i].sector - sector < count) {
+            if (result == RES_OK) {
+                memcpy(cache[i].data, buff + (cache[i].sector - sector) * 512, 512);
+                cache[i].dirty = 0;                     // The card now holds the newer copy
+            } else {
+                cache[i].used = 0;
+            }
         }
-        sector++;
-        buff += 512;
-        count--;
     }
-    printf("Write completed successfully\r\n");
-    return RES_OK;
+#endif
+
+    PROF_END(PROF_DISK_WRITE, t);
+    return result;
+}
+
+DRESULT disk_write_meta(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
+#if DISK_CACHE_SECTORS
+    if (pdrv != 0 || count != 1 || (Stat & STA_NOINIT)) return disk_write(pdrv, buff, sector, count);
+
+    PROF_BEGIN(t);
+    DRESULT result = RES_OK;
+
+    Cache_Line* line = Cache_Find(sector);
+    if (!line) line = Cache_Claim(sector);
+    if (!line) {
+        result = RES_ERROR;
+    } else {
+        memcpy(line -> data, buff, 512);
+        Cache_Touch(line);
+#if DISK_CACHE_WRITEBACK
+        if (line -> dirty) cacheStats.absorbed++;
+        line -> dirty = 1;
+#else
+        if (Card_Write(line -> data, sector, 1) != RES_OK) {
+            line -> used = 0;
+            result = RES_ERROR;
+        }
+#endif
+    }
+
+    PROF_END(PROF_DISK_WRITE, t);
+    return result;
+#else
+    return disk_write(pdrv, buff, sector, count);
+#endif
 }
 
 DRESULT disk_ioctl (
@@ -112,16 +339,24 @@ DRESULT disk_ioctl (
     if (pdrv != 0) return RES_PARERR;
     if (Stat & STA_NOINIT) return RES_NOTRDY;
 
+    PROF_BEGIN(t);
     DRESULT res = RES_ERROR;
 
     switch (cmd) {
         case CTRL_SYNC:
+#if DISK_CACHE_SECTORS
+            if (Cache_Flush() != RES_OK) break;
+#endif
+            if (SD_Sync() != 0) {                       // Writes return before programming ends
+                CON_ERROR("Card still busy at sync\r\n");
+                break;
+            }
             res = RES_OK;
             break;
 
         case GET_SECTOR_COUNT:
-            *(DWORD*)buff = 0x800000;
-            res = RES_OK;
+            *(LBA_t*)buff = cardSectors;
+            if (cardSectors) res = RES_OK;
             break;
 
         case GET_SECTOR_SIZE:
@@ -129,12 +364,13 @@ DRESULT disk_ioctl (
             res = RES_OK;
             break;
 
-        case GET_BLOCK_SIZE:
-            *(DWORD*)buff = 1;
+        case GET_BLOCK_SIZE:                            // f_mkfs aligns the partition, FAT and data area to it
+            *(DWORD*)buff = cardBlock;
             res = RES_OK;
             break;
     }
 
+    PROF_END(PROF_DISK_IOCTL, t);
     return res;
 }
 
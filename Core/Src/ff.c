@@ -1063,10 +1063,10 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (fs->wflag) {	/* Is the disk access window dirty? */
-		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
+		if (disk_write_meta(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
 			fs->wflag = 0;	/* Clear window dirty flag */
 			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
-				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+				if (fs->n_fats == 2) disk_write_meta(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
 			}
 		} else {
 			res = FR_DISK_ERR;
@@ -1090,7 +1090,7 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 		res = sync_window(fs);		/* Flush the window */
 #endif
 		if (res == FR_OK) {			/* Fill sector window with new data */
-			if (disk_read(fs->pdrv, fs->win, sect, 1) != RES_OK) {
+			if (disk_read_meta(fs->pdrv, fs->win, sect, 1) != RES_OK) {
 				sect = (LBA_t)0 - 1;	/* Invalidate window if read data is not valid */
 				res = FR_DISK_ERR;
 			}
@@ -1127,16 +1127,16 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 				st_dword(fs->win + FSI_Free_Count, fs->free_clst);	/* Number of free clusters */
 				st_dword(fs->win + FSI_Nxt_Free, fs->last_clst);	/* Last allocated culuster */
 				st_dword(fs->win + FSI_TrailSig, 0xAA550000);		/* Trailing signature */
-				disk_write(fs->pdrv, fs->win, fs->winsect = fs->volbase + 1, 1);	/* Write it into the FSInfo sector (Next to VBR) */
+				disk_write_meta(fs->pdrv, fs->win, fs->winsect = fs->volbase + 1, 1);	/* Write it into the FSInfo sector (Next to VBR) */
 			}
 #if FF_FS_EXFAT
 			else if (fs->fs_type == FS_EXFAT) {	/* exFAT: Update PercInUse field in BPB */
-				if (disk_read(fs->pdrv, fs->win, fs->winsect = fs->volbase, 1) == RES_OK) {	/* Load VBR */
+				if (disk_read_meta(fs->pdrv, fs->win, fs->winsect = fs->volbase, 1) == RES_OK) {	/* Load VBR */
 					BYTE perc_inuse = (fs->free_clst <= fs->n_fatent - 2) ? (BYTE)((QWORD)(fs->n_fatent - 2 - fs->free_clst) * 100 / (fs->n_fatent - 2)) : 0xFF;	/* Precent in use 0-100 or 0xFF(unknown) */
 
 					if (fs->win[BPB_PercInUseEx] != perc_inuse) {	/* Write it back into VBR if needed */
 						fs->win[BPB_PercInUseEx] = perc_inuse;
-						disk_write(fs->pdrv, fs->win, fs->winsect, 1);
+						disk_write_meta(fs->pdrv, fs->win, fs->winsect, 1);
 					}
 				}
 			}
@@ -1248,6 +1248,57 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 
 
 #if !FF_FS_READONLY
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+/*-----------------------------------------------------------------------*/
+/* FAT access - In-memory free cluster summary                           */
+/*-----------------------------------------------------------------------*/
+
+static void init_freemap (
+	FATFS* fs		/* Filesystem object, n_fatent is valid */
+)
+{
+	BYTE s = 0;
+
+
+	while (((fs->n_fatent - 1) >> s) >= (DWORD)FF_FREEMAP_SIZE * 8) s++;	/* Smallest group size that fits */
+	fs->fm_shift = s;
+	fs->fm_full = 0;
+	memset(fs->freemap, 0, sizeof fs->freemap);	/* Every group may have a free cluster */
+}
+
+
+static int test_freemap (	/* 1:The group holding the cluster has no free cluster */
+	FATFS* fs,
+	DWORD clst
+)
+{
+	DWORD g = clst >> fs->fm_shift;
+
+
+	return (fs->freemap[g / 8] >> (g % 8)) & 1;
+}
+
+
+static void mark_freemap (
+	FATFS* fs,
+	DWORD clst,		/* Any cluster in the group */
+	int full		/* 1:Group has no free cluster, 0:Group may have one */
+)
+{
+	DWORD g = clst >> fs->fm_shift;
+
+
+	if (full) {
+		fs->freemap[g / 8] |= (BYTE)(1 << (g % 8));
+	} else {
+		fs->freemap[g / 8] &= (BYTE)~(1 << (g % 8));
+	}
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT access - Change value of an FAT entry                             */
 /*-----------------------------------------------------------------------*/
@@ -1264,6 +1315,9 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
+#if FF_USE_FREEMAP
+		if (val == 0) mark_freemap(fs, clst, 0);	/* The group gets a free cluster */
+#endif
 		switch (fs->fs_type) {
 		case FS_FAT12:
 			bc = (UINT)clst; bc += bc / 2;	/* bc: byte offset of the entry */
@@ -1335,6 +1389,16 @@ static DWORD find_bitmap (	/* 0:Not found, 2..:Cluster block found, 0xFFFFFFFF:D
 		if (move_window(fs, fs->bitbase + val / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
 		i = val / 8 % SS(fs); bm = 1 << (val % 8);
 		do {
+			if (bm == 1 && val + 8 < fs->n_fatent - 2 && clst - val > 8) {	/* Whole byte ahead, not reaching the wrap-around or the start cluster */
+				if (fs->win[i] == 0xFF) {	/* 8 clusters in use */
+					val += 8; scl = val; ctr = 0;
+					continue;
+				}
+				if (fs->win[i] == 0 && ncl - ctr > 8) {	/* 8 free clusters, not enough to end the run */
+					val += 8; ctr += 8;
+					continue;
+				}
+			}
 			do {
 				bv = fs->win[i] & bm; bm <<= 1;		/* Get bit value */
 				if (++val >= fs->n_fatent - 2) {	/* Next cluster (with wrap-around) */
@@ -1376,6 +1440,13 @@ static FRESULT change_bitmap (
 	for (;;) {
 		if (move_window(fs, sect++) != FR_OK) return FR_DISK_ERR;
 		do {
+			if (bm == 1 && ncl > 8) {	/* Whole byte to change */
+				if (fs->win[i] != (bv ? 0x00 : 0xFF)) return FR_INT_ERR;	/* Are all bits expected value? */
+				fs->win[i] = bv ? 0xFF : 0x00;
+				fs->wflag = 1;
+				ncl -= 8;
+				continue;
+			}
 			do {
 				if (bv == (int)((fs->win[i] & bm) != 0)) return FR_INT_ERR;	/* Is the bit expected value? */
 				fs->win[i] ^= bm;	/* Flip the bit */
@@ -1600,16 +1671,37 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			}
 		}
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
+#if FF_USE_FREEMAP
+			DWORD gmask = ((DWORD)1 << fs->fm_shift) - 1;
+			int gwhole;							/* The current group has been tested from its top */
+#endif
 			ncl = scl;	/* Start cluster */
+#if FF_USE_FREEMAP
+			gwhole = 0;
+#endif
 			for (;;) {
 				ncl++;							/* Next cluster */
 				if (ncl >= fs->n_fatent) {		/* Check wrap-around */
 					ncl = 2;
 					if (ncl > scl) return 0;	/* No free cluster found? */
 				}
+#if FF_USE_FREEMAP
+				if ((ncl & gmask) == 0 || ncl == 2) gwhole = 1;	/* Entered a group at its top */
+				if (test_freemap(fs, ncl)) {	/* Known full group: jump to its last cluster */
+					if (scl >= ncl && scl <= (ncl | gmask)) return 0;	/* The start cluster is in it: wrapped around */
+					ncl |= gmask;
+					if (ncl >= fs->n_fatent) ncl = fs->n_fatent - 1;
+					continue;
+				}
+#endif
 				cs = get_fat(obj, ncl);			/* Get the cluster status */
 				if (cs == 0) break;				/* Found a free cluster? */
 				if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+#if FF_USE_FREEMAP
+				if (gwhole && ((ncl & gmask) == gmask || ncl == fs->n_fatent - 1)) {
+					mark_freemap(fs, ncl, 1);	/* Tested the whole group without a free cluster */
+				}
+#endif
 				if (ncl == scl) return 0;		/* No free cluster found? */
 			}
 		}
@@ -3600,6 +3692,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 		}
 #endif	/* !FF_FS_READONLY */
 	}
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+	init_freemap(fs);
+#endif
 
 	fs->fs_type = (BYTE)fmt;/* FAT sub-type (the filesystem object gets valid) */
 	fs->id = ++Fsid;		/* Volume mount ID */
@@ -4472,14 +4567,25 @@ FRESULT f_lseek (
 
 #if FF_USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
-		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
+		if (ofs == CREATE_LINKMAP || ofs == EXTEND_LINKMAP) {	/* Create CLMT, or extend a valid one after the file grew */
 			tbl = fp->cltbl;
 			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
 			cl = fp->obj.sclust;		/* Origin of the chain */
+			tcl = 0;
+			if (ofs == EXTEND_LINKMAP && tbl[0] != 0) {	/* Resume at the last fragment in the table */
+				while (tbl[2] != 0) {
+					tbl += 2; ulen += 2;
+				}
+				tcl = tbl[1]; ncl = tbl[0] - 1;
+				cl = tcl + ncl;			/* Last mapped cluster; walk on from there */
+			}
 			if (cl != 0) {
 				do {
 					/* Get a fragment */
-					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
+					if (tcl == 0) {
+						tcl = cl; ncl = 0;	/* Top and length */
+					}
+					ulen += 2;			/* Used items */
 					do {
 						pcl = cl; ncl++;
 						cl = get_fat(&fp->obj, cl);
@@ -4489,6 +4595,7 @@ FRESULT f_lseek (
 					if (ulen <= tlen) {		/* Store the length and top of the fragment */
 						*tbl++ = ncl; *tbl++ = tcl;
 					}
+					tcl = 0;
 				} while (cl < fs->n_fatent);	/* Repeat until end of chain */
 			}
 			*fp->cltbl = ulen;	/* Number of items used */
@@ -4847,11 +4954,18 @@ FRESULT f_getfree (
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
 		/* If free_clst is valid, return it without full FAT scan */
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+		if (fs->free_clst <= fs->n_fatent - 2 && (fs->fm_full || fs->fs_type == FS_EXFAT)) {	/* The scan also builds the free map */
+#else
 		if (fs->free_clst <= fs->n_fatent - 2) {
+#endif
 			*nclst = fs->free_clst;
 		} else {
 			/* Scan FAT to obtain the correct free cluster count */
 			nfree = 0;
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+			memset(fs->freemap, 0xFF, sizeof fs->freemap);	/* Every group is full until a free entry shows up */
+#endif
 			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
 				clst = 2; obj.fs = fs;
 				do {
@@ -4862,7 +4976,12 @@ FRESULT f_getfree (
 					if (stat == 1) {
 						res = FR_INT_ERR; break;
 					}
-					if (stat == 0) nfree++;
+					if (stat == 0) {
+						nfree++;
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+						mark_freemap(fs, clst, 0);
+#endif
+					}
 				} while (++clst < fs->n_fatent);
 			} else {
 #if FF_FS_EXFAT
@@ -4896,12 +5015,18 @@ FRESULT f_getfree (
 							if (res != FR_OK) break;
 						}
 						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;	/* FAT16: Is this cluster free? */
+							stat = ld_word(fs->win + i);	/* FAT16: Is this cluster free? */
 							i += 2;	/* Next entry */
 						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;	/* FAT32: Is this cluster free? */
+							stat = ld_dword(fs->win + i) & 0x0FFFFFFF;	/* FAT32: Is this cluster free? */
 							i += 4;	/* Next entry */
 						}
+						if (stat == 0) {
+							nfree++;
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+							mark_freemap(fs, fs->n_fatent - clst, 0);	/* clst counts down from the first entry */
+#endif
+						}
 						i %= SS(fs);
 					} while (--clst);
 				}
@@ -4911,6 +5036,15 @@ FRESULT f_getfree (
 				fs->free_clst = nfree;	/* Now free cluster count is valid */
 				fs->fsi_flag |= 1;		/* FAT32/exfAT : Allocation information is to be updated */
 			}
+#if !FF_FS_READONLY && FF_USE_FREEMAP
+			if (fs->fs_type != FS_EXFAT) {
+				if (res == FR_OK) {
+					fs->fm_full = 1;
+				} else {
+					init_freemap(fs);	/* Partial scan; fall back to the all-unknown map */
+				}
+			}
+#endif
 		}
 	}
 
@@ -5752,6 +5886,19 @@ FRESULT f_forward (
 #define GPT_ITEMS	128			/* Number of GPT table size (>=128, sector aligned) */
 
 
+/* First LBA of the first MBR partition: the first erase block boundary at or past one track,
+   so an SD card's partition starts on an allocation unit boundary */
+static DWORD mbr_first_lba (
+	BYTE drv			/* Physical drive number */
+)
+{
+	DWORD sz_blk;
+
+	if (disk_ioctl(drv, GET_BLOCK_SIZE, &sz_blk) != RES_OK || sz_blk > 0x8000 || (sz_blk & (sz_blk - 1))) sz_blk = 1;
+	return (N_SEC_TRACK + sz_blk - 1) / sz_blk * sz_blk;
+}
+
+
 /* Create partitions on the physical drive in format of MBR or GPT */
 
 static FRESULT create_partition (
@@ -5861,7 +6008,7 @@ static FRESULT create_partition (
 
 		memset(buf, 0, FF_MAX_SS);		/* Clear MBR */
 		pte = buf + MBR_Table;	/* Partition table in the MBR */
-		for (i = 0, nxt_alloc32 = n_sc; i < 4 && nxt_alloc32 != 0 && nxt_alloc32 < sz_drv32; i++, nxt_alloc32 += sz_part32) {
+		for (i = 0, nxt_alloc32 = mbr_first_lba(drv); i < 4 && nxt_alloc32 != 0 && nxt_alloc32 < sz_drv32; i++, nxt_alloc32 += sz_part32) {
 			sz_part32 = (DWORD)plst[i];	/* Get partition size */
 			if (sz_part32 <= 100) sz_part32 = (sz_part32 == 100) ? sz_drv32 : sz_drv32 / 100 * sz_part32;	/* Size in percentage? */
 			if (nxt_alloc32 + sz_part32 > sz_drv32 || nxt_alloc32 + sz_part32 < nxt_alloc32) sz_part32 = sz_drv32 - nxt_alloc32;	/* Clip at drive size */
@@ -6008,8 +6155,9 @@ FRESULT f_mkfs (
 			} else
 #endif
 			{	/* Partitioning is in MBR */
-				if (sz_vol > N_SEC_TRACK) {
-					b_vol = N_SEC_TRACK; sz_vol -= b_vol;	/* Estimated partition offset and size */
+				n = mbr_first_lba(pdrv);
+				if (sz_vol > n) {
+					b_vol = n; sz_vol -= b_vol;	/* Partition offset and size, as create_partition() will place it */
 				}
 			}
 		}
@@ -6236,8 +6384,11 @@ FRESULT f_mkfs (
 
 			/* Align data area to erase block boundary (for flash memory media) */
 			n = (DWORD)(((b_data + sz_blk - 1) & ~(sz_blk - 1)) - b_data);	/* Sectors to next nearest from current data base */
-			if (fsty == FS_FAT32) {		/* FAT32: Move FAT */
+			if (fsty == FS_FAT32) {		/* FAT32: Move FAT to the block boundary and expand it to the next one */
+				n = (DWORD)(((b_fat + sz_blk - 1) & ~(sz_blk - 1)) - b_fat);
 				sz_rsv += n; b_fat += n;
+				sz_fat = ((sz_fat * n_fat + sz_blk - 1) & ~(sz_blk - 1)) / n_fat;	/* sz_blk is 1 or even, so n_fat divides it */
+				b_data = b_fat + sz_fat * n_fat;
 			} else {					/* FAT: Expand FAT */
 				if (n % n_fat) {	/* Adjust fractional error if needed */
 					n--; sz_rsv++; b_fat++;
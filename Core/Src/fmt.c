@@ -0,0 +1,164 @@
+// Allocation-free formatter for the console and small string buffers
+// Replaces newlib printf/sprintf, whose vfprintf pulls in _sbrk-backed buffers and costs far more
+// per call than the few specifiers this firmware uses.
+#include "fmt.h"
+#include "console.h"
+
+typedef struct {
+	char* buffer;
+	size_t size;
+	size_t length;
+} Fmt_Buffer;
+
+static void Fmt_ToConsole(void* ctx, char c) {
+	(void)ctx;
+	Console_Putc(c);
+}
+
+// Keeps room for the terminator; the count still grows so the caller can see truncation
+static void Fmt_ToBuffer(void* ctx, char c) {
+	Fmt_Buffer* b = ctx;
+
+	if (b -> length + 1 < b -> size) b -> buffer[b -> length] = c;
+	b -> length++;
+}
+
+static int Fmt_Pad(Fmt_Sink sink, void* ctx, char c, int count) {
+	for (int i = 0; i < count; i++) sink(ctx, c);
+	return count > 0 ? count : 0;
+}
+
+// Digits are produced backwards into a 20-byte scratch, enough for a 64-bit decimal
+static int Fmt_Number(Fmt_Sink sink, void* ctx, uint64_t value, uint8_t negative, uint8_t base, uint8_t upper,
+					  int width, uint8_t left, uint8_t zero) {
+	const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char scratch[20];
+	int n = 0;
+	int out = 0;
+
+	do {
+		if (value <= 0xFFFFFFFF) {															// 32-bit divides stay in hardware
+			uint32_t v = (uint32_t)value;
+			scratch[n++] = digits[v % base];
+			value = v / base;
+		} else {
+			scratch[n++] = digits[value % base];
+			value /= base;
+		}
+	} while (value);
+
+	int length = n + negative;
+	if (!left && !zero) out += Fmt_Pad(sink, ctx, ' ', width - length);
+	if (negative) {
+		sink(ctx, '-');
+		out++;
+	}
+	if (!left && zero) out += Fmt_Pad(sink, ctx, '0', width - length);
+	while (n) sink(ctx, scratch[--n]);
+	out += length - negative;
+	if (left) out += Fmt_Pad(sink, ctx, ' ', width - length);
+
+	return out;
+}
+
+int Fmt_Format(Fmt_Sink sink, void* ctx, const char* fmt, va_list ap) {
+	int out = 0;
+
+	while (*fmt) {
+		char c = *fmt++;
+		if (c != '%') {
+			sink(ctx, c);
+			out++;
+			continue;
+		}
+
+		uint8_t left = 0;
+		uint8_t zero = 0;
+		uint8_t length = 0;
+		int width = 0;
+
+		for (;; fmt++) {
+			if (*fmt == '-') left = 1;
+			else if (*fmt == '0') zero = 1;
+			else break;
+		}
+		while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+		while (*fmt == 'l') {
+			length++;
+			fmt++;
+		}
+
+		c = *fmt;
+		if (c == 0) break;
+		fmt++;
+
+		switch (c) {
+			case 'd':
+			case 'i': {
+				int64_t v;
+				if (length >= 2) v = va_arg(ap, long long);
+				else if (length == 1) v = (int32_t)va_arg(ap, long);
+				else v = va_arg(ap, int);
+				uint64_t magnitude = v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+				out += Fmt_Number(sink, ctx, magnitude, v < 0, 10, 0, width, left, zero);
+				break;
+			}
+			case 'u':
+			case 'x':
+			case 'X': {
+				uint64_t v;
+				if (length >= 2) v = va_arg(ap, unsigned long long);
+				else if (length == 1) v = (uint32_t)va_arg(ap, unsigned long);
+				else v = va_arg(ap, unsigned int);
+				out += Fmt_Number(sink, ctx, v, 0, c == 'u' ? 10 : 16, c == 'X', width, left, zero);
+				break;
+			}
+			case 'c':
+				if (!left) out += Fmt_Pad(sink, ctx, ' ', width - 1);
+				sink(ctx, (char)va_arg(ap, int));
+				out++;
+				if (left) out += Fmt_Pad(sink, ctx, ' ', width - 1);
+				break;
+			case 's': {
+				const char* s = va_arg(ap, const char*);
+				int n = 0;
+				if (!s) s = "(null)";
+				while (s[n]) n++;
+				if (!left) out += Fmt_Pad(sink, ctx, ' ', width - n);
+				for (int i = 0; i < n; i++) sink(ctx, s[i]);
+				out += n;
+				if (left) out += Fmt_Pad(sink, ctx, ' ', width - n);
+				break;
+			}
+			default:																		// %% and anything unsupported print literally
+				sink(ctx, c);
+				out++;
+				break;
+		}
+	}
+
+	return out;
+}
+
+int Fmt_Printf(const char* fmt, ...) {
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = Fmt_Format(Fmt_ToConsole, 0, fmt, ap);
+	va_end(ap);
+
+	return n;
+}
+
+// Same contract as snprintf: always terminated when size > 0, returns the untruncated length
+int Fmt_Snprintf(char* buffer, size_t size, const char* fmt, ...) {
+	Fmt_Buffer b = { buffer, size, 0 };
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = Fmt_Format(Fmt_ToBuffer, &b, fmt, ap);
+	va_end(ap);
+
+	if (size) buffer[b.length < size ? b.length : size - 1] = 0;
+	return n;
+}
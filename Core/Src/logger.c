@@ -0,0 +1,877 @@
+// Single producer / single consumer ring between sample producers and the SD writer
+// The producer only ever writes head and the consumer only ever writes tail, so neither side masks interrupts.
+// Only one context may push; producers in several ISRs must share one priority level.
+#include "main.h"
+#include <string.h>
+#include "logger.h"
+#include "profile.h"
+#include "recfmt.h"
+#include "lz.h"
+#include "sd_spi.h"
+#if LOG_SPILL
+#include "spill.h"
+#endif
+
+#define LOG_FA_MODIFIED		0x40														// FatFs private FA_MODIFIED; f_sync rewrites the entry only when set
+
+static uint8_t ring[LOG_RING_SIZE];
+static volatile uint32_t head;																// Free running; producer owned
+static volatile uint32_t tail;																// Free running; consumer owned
+static uint32_t sealed;																		// Free running; [tail, sealed) is sealed and ready to write
+static uint8_t logSeal = 0;																	// Stream of unsealed recfmt blocks; fixed at open
+static uint8_t sealNext = 0;
+static volatile Log_Stats stats;
+static FIL logFile;
+static uint8_t logOpen = 0;
+static uint8_t logSuspended = 0;															// Log_Suspend kept the stream for the next open
+static uint8_t logRaw = 0;																	// Contiguous extent written with disk_write
+static LBA_t rawBase;																		// First sector of the extent
+static FSIZE_t rawExtent;																	// Reserved bytes
+static uint8_t rawSector[512];																// Last partially filled sector of the extent
+static uint8_t logCompress = 0;																// Frames instead of plain bytes; fixed at open
+static uint8_t compressNext = 0;
+static uint8_t spillNext = 0;
+static uint8_t logJournal = 0;																// Extent written as journal sectors
+static uint32_t jrnEpoch;
+static uint32_t jrnSeq;																		// Next sector of the extent
+static uint32_t jrnCommitted;																// Sectors the directory entry covers
+static uint32_t jrnLastWrite;																// HAL_GetTick of the last sector write
+static Log_SyncPolicy syncPolicy = {
+	LOG_SYNC_BYTES, LOG_SYNC_MS, LOG_SYNC_GRACE_MS, LOG_SYNC_IDLE, LOG_SYNC_PRESSURE, LOG_SYNC_COST_MS, LOG_SYNC_MAX_SCALE
+};
+static uint32_t syncScale = 1;
+static uint32_t syncLast;																	// HAL_GetTick of the last sync, or of the first unsynced byte
+static uint32_t syncWritten;																// stats.written at the last sync
+static uint32_t syncDue;																	// HAL_GetTick when the pending sync fell due
+static uint8_t syncPending = 0;																// A sync is due but deferred
+static uint8_t jrnBuffer[LOG_CHUNK_SIZE];													// Sectors being sealed for one multi-block write
+
+#if LOG_SPILL
+static uint8_t logSpill = 0;																// Spill while the card is busy; fixed at open
+static uint32_t spillRead;																	// Spilled bytes are [spillRead, spillWrite) of the area
+static uint32_t spillWrite;
+static uint32_t spillEnd;																	// Usable size; cut short by a program error
+static uint32_t spillBusy;																	// HAL_GetTick when the card was first seen busy
+static uint8_t spillWait = 0;																// spillBusy is valid
+static uint8_t spillBuffer[LOG_SPILL_STEP];
+#endif
+
+#if LOG_COMPRESS
+#define LOG_FRAME_INPUT		(LOG_CHUNK_SIZE - LZ_FRAME_HDR)									// A stored frame still fills exactly one chunk
+
+static uint8_t frameInput[LOG_FRAME_INPUT];
+static uint8_t frame[LOG_CHUNK_SIZE];
+#endif
+
+#if LOG_SPILL
+// Empties the area; the 1-2 s erase only runs when something was programmed since the last one
+static void Log_SpillErase() {
+	const uint32_t* word = (const uint32_t*)Spill_Data();
+
+	spillRead = 0;
+	spillWrite = 0;
+	spillEnd = SPILL_SIZE;
+	spillWait = 0;
+	for (uint32_t i = 0; i < SPILL_SIZE / 4; i++) {
+		if (word[i] == 0xFFFFFFFF) continue;
+		if (Spill_Erase()) {
+			stats.spillErrors++;
+			spillEnd = 0;
+		} else {
+			stats.spillErases++;
+		}
+		break;
+	}
+}
+#endif
+
+// The only erase while a log is open: once every spilled byte is on the card and more than LOG_SPILL_RECLAIM
+// bytes of the area are used. Handlers that run from flash stall for the 1-2 s it takes, and the ring fills
+// meanwhile, so it is never started with spilled bytes waiting; without it the area would fill once and
+// spilling would stop until the next open.
+static void Log_SpillReclaim() {
+#if LOG_SPILL
+	if (logSpill && spillRead == spillWrite && spillWrite > LOG_SPILL_RECLAIM) Log_SpillErase();
+#endif
+}
+
+// Bytes ready for the card: the spilled ones first, then the sealed part of the ring
+static uint32_t Log_Available() {
+#if LOG_SPILL
+	return (spillWrite - spillRead) + (sealed - tail);
+#else
+	return sealed - tail;
+#endif
+}
+
+// Seals the blocks pushed since the last call in place, with the CRC unit from thread context. Every push
+// is one whole block and the ring holds a whole number of them, so a block never wraps.
+static void Log_Seal() {
+	uint32_t h = head;
+
+	if (!logSeal) {
+		sealed = h;
+		return;
+	}
+	while (h - sealed >= REC_BLOCK_SIZE) {
+		PROF_BEGIN(t);
+		Rec_Seal(&ring[sealed & (LOG_RING_SIZE - 1)]);
+		PROF_END(PROF_LOG_SEAL, t);
+		sealed += REC_BLOCK_SIZE;
+	}
+}
+
+// Releases length bytes from the front of that stream
+static void Log_Consume(uint32_t length) {
+#if LOG_SPILL
+	uint32_t n = spillWrite - spillRead;
+	if (n > length) n = length;
+	spillRead += n;
+	length -= n;
+#endif
+	__DMB();																				// Finished reading before the space is released
+	tail += length;
+}
+
+// Called by every open once stats are cleared
+static void Log_ResetSpill() {
+#if LOG_SPILL
+	logSpill = spillNext;
+	if (logSpill) Log_SpillErase();
+#endif
+}
+
+static void Log_ResetSync() {
+	syncScale = 1;
+	syncLast = HAL_GetTick();
+	syncWritten = stats.written;
+	syncPending = 0;
+	stats.syncScale = 1;
+}
+
+// Called by every open: a new stream, unless Log_Suspend kept the ring, spill area and stats for this file
+static void Log_ResetStream() {
+	if (logSuspended) {
+		logSuspended = 0;
+		Log_ResetSync();
+		return;
+	}
+
+	head = 0;
+	tail = 0;
+	sealed = 0;
+	logSeal = sealNext;
+	memset((void*)&stats, 0, sizeof(stats));
+	Log_ResetSync();
+	Log_ResetSpill();
+}
+
+FRESULT Log_Open(const char* path) {
+	FRESULT fr;
+
+	fr = f_open(&logFile, path, FA_WRITE | FA_OPEN_APPEND);
+	if (fr != FR_OK) return fr;
+
+	Log_ResetStream();
+	logRaw = 0;
+	logJournal = 0;
+	logCompress = compressNext;
+	logOpen = 1;
+
+	if (logCompress && f_tell(&logFile) % 512) {											// Frames start on sector boundaries
+		static const uint8_t zero[64];
+		UINT bw;
+		while (fr == FR_OK && f_tell(&logFile) % 512) {
+			UINT n = 512 - f_tell(&logFile) % 512;
+			fr = f_write(&logFile, zero, n < sizeof(zero) ? n : sizeof(zero), &bw);
+		}
+	}
+	return fr;
+}
+
+// Takes effect at the next Log_Service; the back-off starts over
+void Log_SetSyncPolicy(const Log_SyncPolicy* policy) {
+	syncPolicy = *policy;
+	if (syncPolicy.maxScale == 0) syncPolicy.maxScale = 1;
+	syncScale = 1;
+	stats.syncScale = 1;
+}
+
+// Frames written from the next Log_Open or Log_OpenContiguous on are LZ compressed
+void Log_SetCompression(uint8_t enable) {
+	compressNext = LOG_COMPRESS && enable;
+}
+
+// Logs opened from now on take recfmt blocks from a Rec_DeferSeal encoder and seal them in Log_Service
+void Log_SetSeal(uint8_t enable) {
+	sealNext = enable;
+}
+
+// Logs opened from now on spill to internal flash while the card is busy; see LOG_SPILL_HIGH
+void Log_SetSpill(uint8_t enable) {
+	spillNext = LOG_SPILL && enable;
+}
+
+// Creates the file with extent bytes reserved as one contiguous run of clusters; data then goes
+// straight to the computed sectors and only the directory entry size changes on Log_Flush.
+// The unused tail of the extent is released by Log_Close.
+FRESULT Log_OpenContiguous(const char* path, FSIZE_t extent) {
+	FRESULT fr;
+
+	fr = f_open(&logFile, path, FA_WRITE | FA_CREATE_ALWAYS);
+	if (fr != FR_OK) return fr;
+
+	fr = f_expand(&logFile, extent, 1);														// FR_DENIED when no run is long enough
+	if (fr != FR_OK) {
+		f_close(&logFile);
+		return fr;
+	}
+
+	FATFS* fs = logFile.obj.fs;
+	rawBase = fs -> database + (LBA_t)(logFile.obj.sclust - 2) * fs -> csize;
+	rawExtent = logFile.obj.objsize;														// Whole clusters
+	logFile.obj.objsize = 0;																// Nothing written yet
+	logFile.fptr = 0;
+
+	Log_ResetStream();
+	logRaw = 1;
+	logJournal = 0;
+	logCompress = compressNext;
+	logOpen = 1;
+
+	return FR_OK;
+}
+
+static void Log_Put32(uint8_t* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t Log_Get32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Journal sectors are sealed and checked in the main loop, like the recfmt blocks in Log_Seal; any handler
+// that still seals is sent to the software sum by REC_CRC, so the CRC unit is never reset under this one.
+static uint32_t Log_JournalCRC(const uint8_t* sector) {
+	return REC_CRC(sector, 508 / 4);
+}
+
+// 0 for an intact journal sector, 1 for no journal magic, 2 for a CRC mismatch; hdr is filled in either way
+int Log_CheckJournal(const uint8_t* sector, Log_JournalHdr* hdr) {
+	hdr -> used = sector[2] | (sector[3] << 8);
+	hdr -> epoch = Log_Get32(&sector[4]);
+	hdr -> seq = Log_Get32(&sector[8]);
+	hdr -> extent = Log_Get32(&sector[12]);
+
+	if ((sector[0] | (sector[1] << 8)) != LOG_JOURNAL_MAGIC || hdr -> used > LOG_JOURNAL_DATA) return 1;
+	if (Log_Get32(&sector[508]) != Log_JournalCRC(sector)) return 2;
+	return 0;
+}
+
+static void Log_SealJournal(uint8_t* sector, uint16_t used, uint32_t seq) {
+	sector[0] = LOG_JOURNAL_MAGIC & 0xFF;
+	sector[1] = LOG_JOURNAL_MAGIC >> 8;
+	sector[2] = used & 0xFF;
+	sector[3] = used >> 8;
+	Log_Put32(&sector[4], jrnEpoch);
+	Log_Put32(&sector[8], seq);
+	Log_Put32(&sector[12], (uint32_t)(rawExtent / 512));
+	memset(&sector[LOG_JOURNAL_HDR + used], 0, LOG_JOURNAL_DATA - used);
+	Log_Put32(&sector[508], Log_JournalCRC(sector));
+}
+
+// Rewrites the extent in the first journal sector to the closing size, so Log_RecoverJournal finds
+// nothing left to release once Log_Close has given the tail back
+static FRESULT Log_MarkJournal(uint32_t sectors) {
+	BYTE pdrv = logFile.obj.fs -> pdrv;
+
+	if (disk_read(pdrv, jrnBuffer, rawBase, 1) != RES_OK) return FR_DISK_ERR;
+	Log_Put32(&jrnBuffer[12], sectors);
+	Log_Put32(&jrnBuffer[508], Log_JournalCRC(jrnBuffer));
+	return disk_write(pdrv, jrnBuffer, rawBase, 1) == RES_OK ? FR_OK : FR_DISK_ERR;
+}
+
+// Updates the directory entry to everything written so far
+static FRESULT Log_Commit() {
+	FRESULT fr;
+
+	if (logRaw) {																			// The chain is already on the FAT; only the size moves
+		logFile.obj.objsize = logFile.fptr;
+		logFile.flag |= LOG_FA_MODIFIED;
+	}
+
+	uint32_t start = HAL_GetTick();
+	PROF_BEGIN(t);
+	fr = f_sync(&logFile);
+	PROF_END(PROF_F_SYNC, t);
+	uint32_t now = HAL_GetTick();
+	uint32_t cost = now - start;
+
+	stats.commits++;
+	stats.syncMsLast = cost;
+	stats.syncMsTotal += cost;
+	if (cost > stats.syncMsMax) stats.syncMsMax = cost;
+
+	if (cost > syncPolicy.costMs && syncScale < syncPolicy.maxScale) syncScale <<= 1;	// Back off while syncs are expensive
+	else if (cost * 2 <= syncPolicy.costMs && syncScale > 1) syncScale >>= 1;
+	stats.syncScale = syncScale;
+
+	syncLast = now;
+	syncWritten = stats.written;
+	syncPending = 0;
+	if (fr == FR_OK && logJournal) jrnCommitted = jrnSeq;
+	return fr;
+}
+
+// Decides whether Log_Service syncs now; see Log_SyncPolicy
+static FRESULT Log_Schedule() {
+	uint32_t now = HAL_GetTick();
+	uint32_t dirty = stats.written - syncWritten;
+	uint32_t pending = head - tail;
+	uint32_t interval = syncPolicy.intervalMs * syncScale;
+	uint8_t hold;
+	uint32_t budget = syncPolicy.bytes * syncScale;
+	uint8_t due;
+
+	if (dirty == 0) {																		// The interval counts from the first unsynced byte
+		syncLast = now;
+		return FR_OK;
+	}
+
+	if (logJournal) {
+		due = (now - syncLast) >= (interval > LOG_JOURNAL_COMMIT_MS ? interval : LOG_JOURNAL_COMMIT_MS);
+	} else {
+		due = (now - syncLast) >= interval
+			|| (budget && dirty >= budget)
+			|| (budget && Log_Available() <= syncPolicy.idle && dirty >= budget / 4);
+	}
+	if (!due) return FR_OK;
+
+	if (!syncPending) syncDue = now;
+	hold = now - syncDue < syncPolicy.graceMs && (pending >= syncPolicy.pressure || SD_IsBusy());
+#if LOG_SPILL
+	if (logSpill && SD_IsBusy()) hold = 1;													// Waiting out the card is what spilling avoids
+#endif
+	if (hold) {
+		if (!syncPending) stats.syncDeferred++;												// Counted once per due sync
+		syncPending = 1;
+		return FR_OK;
+	}
+
+	return Log_Commit();
+}
+
+// Contiguous extent written as journal sectors: each carries the file epoch, its own index and a CRC,
+// so Log_RecoverJournal can tell what reached the card after the last commit. Compression is off here.
+FRESULT Log_OpenJournal(const char* path, FSIZE_t extent) {
+	FRESULT fr;
+	Log_JournalHdr old;
+	uint8_t compress = compressNext;
+
+	compressNext = 0;
+	fr = Log_OpenContiguous(path, extent);
+	compressNext = compress;
+	if (fr != FR_OK) return fr;
+
+	jrnEpoch = (HAL_GetTick() * 2654435761U) ^ (uint32_t)rawBase;						// A journal that used these clusters before must not match
+	if (disk_read(logFile.obj.fs -> pdrv, jrnBuffer, rawBase, 1) == RES_OK && Log_CheckJournal(jrnBuffer, &old) != 1) {
+		jrnEpoch = old.epoch + 1;
+	}
+
+	jrnSeq = 0;
+	jrnCommitted = 0;
+	jrnLastWrite = HAL_GetTick();
+	logJournal = 1;
+
+	return Log_Commit();																	// Start cluster goes into the entry now so recovery can find the extent
+}
+
+// Mount-time scan of a journal that may not have been closed: walks the sectors after the committed size
+// while epoch and index match, sets the size to the last valid one and releases the rest of the extent.
+// Must run before the journal is opened for writing.
+FRESULT Log_RecoverJournal(const char* path, Log_Recovery* rec) {
+	FIL file;
+	FRESULT fr;
+	Log_JournalHdr first, hdr;
+
+	memset(rec, 0, sizeof(*rec));
+	fr = f_open(&file, path, FA_READ | FA_WRITE);
+	if (fr != FR_OK) return fr;
+
+	FATFS* fs = file.obj.fs;
+	uint32_t end = (uint32_t)(f_size(&file) / 512);
+	uint32_t extent = end;
+	rec -> committed = end;
+	if (file.obj.sclust == 0) return f_close(&file);
+
+	LBA_t base = fs -> database + (LBA_t)(file.obj.sclust - 2) * fs -> csize;
+	if (disk_read(fs -> pdrv, jrnBuffer, base, 1) != RES_OK) {
+		f_close(&file);
+		return FR_DISK_ERR;
+	}
+	if (Log_CheckJournal(jrnBuffer, &first) == 0 && first.seq == 0) {
+		extent = first.extent;
+		while (end < extent) {
+			if (disk_read(fs -> pdrv, jrnBuffer, base + end, 1) != RES_OK) break;
+			if (Log_CheckJournal(jrnBuffer, &hdr) != 0 || hdr.epoch != first.epoch || hdr.seq != end) break;
+			rec -> bytes += hdr.used;
+			end++;
+		}
+	} else if (end != 0) {																	// Not a journal; leave it alone
+		f_close(&file);
+		return FR_NO_FILE;
+	}
+	rec -> recovered = end - rec -> committed;
+
+	// A no-FAT-chain exFAT file only owns the clusters its size covers, so the tail is released against the
+	// whole reserved run even when nothing was recovered; after a clean Log_Close the first sector says end.
+	file.obj.objsize = (FSIZE_t)extent * 512;												// Whole reserved run, as Log_Close does
+	file.fptr = 0;
+	fr = f_lseek(&file, (FSIZE_t)end * 512);
+	if (fr == FR_OK) fr = f_truncate(&file);
+	file.obj.objsize = (FSIZE_t)end * 512;
+	file.flag |= LOG_FA_MODIFIED;
+
+	FRESULT closed = f_close(&file);
+	return fr != FR_OK ? fr : closed;
+}
+
+// Producer side; a record either fits completely or is dropped, so the file never holds torn records
+uint8_t Log_Push(const void* data, uint16_t length) {
+	uint32_t h = head;
+	uint32_t used = h - tail;
+
+	if (length > LOG_RING_SIZE - used) {
+		stats.drops++;
+		stats.dropBytes += length;
+		return 1;
+	}
+
+	uint32_t offset = h & (LOG_RING_SIZE - 1);
+	uint32_t first = LOG_RING_SIZE - offset;
+	if (first > length) first = length;
+
+	memcpy(&ring[offset], data, first);
+	memcpy(&ring[0], (const uint8_t*)data + first, length - first);
+
+	__DMB();																				// Data must land before the consumer sees the new head
+	head = h + length;
+
+	used += length;
+	if (used > stats.highWater) stats.highWater = used;
+
+	return 0;
+}
+
+uint32_t Log_Pending() {
+#if LOG_SPILL
+	return (spillWrite - spillRead) + (head - tail);
+#else
+	return head - tail;
+#endif
+}
+
+// f_write replacement for the contiguous extent; a partial sector is kept in rawSector and rewritten as it fills
+static FRESULT Log_WriteRaw(const uint8_t* data, UINT length, UINT* bw) {
+	BYTE pdrv = logFile.obj.fs -> pdrv;
+	FSIZE_t pos = logFile.fptr;
+
+	*bw = 0;
+	if (length > rawExtent - pos) length = rawExtent - pos;									// Extent full; short count like a full volume
+
+	while (length > 0) {
+		UINT offset = pos % 512;
+		UINT n;
+
+		if (offset == 0 && length >= 512) {													// Whole sectors straight from the ring
+			n = length & ~511U;
+			if (disk_write(pdrv, data, rawBase + pos / 512, n / 512) != RES_OK) return FR_DISK_ERR;
+		} else {
+			n = 512 - offset;
+			if (n > length) n = length;
+			memcpy(&rawSector[offset], data, n);
+			if (disk_write(pdrv, rawSector, rawBase + pos / 512, 1) != RES_OK) return FR_DISK_ERR;
+		}
+
+		data += n;
+		pos += n;
+		length -= n;
+		*bw += n;
+		logFile.fptr = pos;
+	}
+
+	return FR_OK;
+}
+
+// Copies length bytes starting skip bytes past tail out of the ring
+static void Log_PeekRing(uint8_t* out, uint32_t skip, uint32_t length) {
+	uint32_t offset = (tail + skip) & (LOG_RING_SIZE - 1);
+	uint32_t first = LOG_RING_SIZE - offset;
+	if (first > length) first = length;
+
+	memcpy(out, &ring[offset], first);
+	memcpy(&out[first], ring, length - first);
+}
+
+// Same over the whole stream, spilled bytes first
+static void Log_Peek(uint8_t* out, uint32_t skip, uint32_t length) {
+#if LOG_SPILL
+	uint32_t spilled = spillWrite - spillRead;
+	if (skip < spilled) {
+		uint32_t n = spilled - skip;
+		if (n > length) n = length;
+		memcpy(out, Spill_Data() + spillRead + skip, n);
+		out += n;
+		length -= n;
+		skip = 0;
+	} else {
+		skip -= spilled;
+	}
+#endif
+	Log_PeekRing(out, skip, length);
+}
+
+#if LOG_SPILL
+// Keeps the writer off a busy card. Past LOG_SPILL_HIGH and LOG_SPILL_BUSY_MS the ring is copied into the
+// area down to LOG_SPILL_LOW; the area sits in front of the ring, so the order is kept. Returns 1 when
+// nothing should be written yet, 0 when the card is ready or the area is full and waiting is all that is left.
+static uint8_t Log_Spill() {
+	if (!logSpill) return 0;
+	if (!SD_IsBusy()) {
+		spillWait = 0;
+		return 0;
+	}
+
+	uint32_t now = HAL_GetTick();
+	if (!spillWait) {
+		spillBusy = now;
+		spillWait = 1;
+	}
+
+	Log_Seal();																				// Flash cannot take the CRC afterwards
+	uint32_t pending = sealed - tail;
+	if (pending < LOG_SPILL_HIGH || now - spillBusy < LOG_SPILL_BUSY_MS) return 1;
+
+	while (pending > LOG_SPILL_LOW) {
+		uint32_t n = pending - LOG_SPILL_LOW;
+		if (n > LOG_SPILL_STEP) n = LOG_SPILL_STEP;
+		if (n > spillEnd - spillWrite) n = spillEnd - spillWrite;
+		n &= ~3U;																			// Whole flash words
+		if (n == 0) {
+			stats.spillFull++;
+			return 0;
+		}
+
+		Log_PeekRing(spillBuffer, 0, n);
+		if (Spill_Program(spillWrite, spillBuffer, n)) {									// Those bytes stay in the ring
+			stats.spillErrors++;
+			spillEnd = spillWrite;
+			return 0;
+		}
+
+		__DMB();
+		tail += n;
+		spillWrite += n;
+		stats.spilled += n;
+		if (spillWrite - spillRead > stats.spillMax) stats.spillMax = spillWrite - spillRead;
+		Log_Seal();
+		pending = sealed - tail;
+	}
+
+	return 1;
+}
+#else
+static inline uint8_t Log_Spill() {
+	return 0;
+}
+#endif
+
+// The timed write underneath both modes
+static FRESULT Log_Store(const uint8_t* data, UINT length, UINT* bw) {
+	FRESULT fr;
+
+	uint32_t start = HAL_GetTick();
+	PROF_BEGIN(t);
+	fr = logRaw ? Log_WriteRaw(data, length, bw) : f_write(&logFile, data, length, bw);
+	PROF_END(PROF_F_WRITE, t);
+	uint32_t elapsed = HAL_GetTick() - start;
+
+	stats.writeMs += elapsed;
+	if (elapsed > stats.maxWriteMs) stats.maxWriteMs = elapsed;
+	if (elapsed > LOG_STALL_MS) stats.stalls++;
+
+	return fr;
+}
+
+#if LOG_COMPRESS
+// Compresses length bytes at tail (at most LOG_FRAME_INPUT) into one frame padded to whole sectors
+static FRESULT Log_WriteFrame(uint32_t length) {
+	FRESULT fr;
+	UINT bw;
+
+	Log_Peek(frameInput, 0, length);
+
+	PROF_BEGIN(t);
+	uint32_t size = LZ_Frame(frameInput, length, frame);
+#if PROFILE_ENABLE
+	stats.frameCycles += PROF_NOW() - t;
+#endif
+	PROF_END(PROF_LOG_COMPRESS, t);
+
+	uint32_t padded = (size + 511) & ~511U;
+	memset(&frame[size], 0, padded - size);
+
+	fr = Log_Store(frame, padded, &bw);
+	if (fr == FR_OK && bw < padded) fr = FR_DENIED;											// Volume or extent full; the frame is not consumed
+	if (fr != FR_OK) return fr;
+
+	Log_Consume(length);
+	stats.written += padded;
+	stats.frames++;
+	stats.frameIn += length;
+	if ((frame[2] | (frame[3] << 8)) & LZ_FRAME_RAW) stats.rawFrames++;
+
+	return FR_OK;
+}
+#endif
+
+// Writes the sectors sealed in jrnBuffer at jrnSeq
+static FRESULT Log_StoreJournal(uint32_t sectors) {
+	FRESULT fr;
+	UINT bw;
+
+	fr = Log_Store(jrnBuffer, sectors * 512, &bw);
+	if (fr == FR_OK && bw < sectors * 512) fr = FR_DENIED;									// Extent full
+	if (fr != FR_OK) {
+		logFile.fptr = (FSIZE_t)jrnSeq * 512;												// A retry rewrites the same sectors
+		return fr;
+	}
+
+	jrnSeq += sectors;
+	stats.written += sectors * 512;
+	jrnLastWrite = HAL_GetTick();
+	return FR_OK;
+}
+
+// Seals pending bytes into journal sectors and writes them up to LOG_CHUNK_SIZE at a time. Without
+// partial only whole batches go out; with it everything does, the last sector short.
+static FRESULT Log_WriteJournal(uint8_t partial) {
+	FRESULT fr = FR_OK;
+
+	for (;;) {
+		uint32_t pending = Log_Available();
+		uint32_t taken = 0;
+		uint32_t sectors = 0;
+
+		if (!partial && (pending < (LOG_CHUNK_SIZE / 512) * LOG_JOURNAL_DATA || Log_Spill())) break;
+		while (sectors < LOG_CHUNK_SIZE / 512 && taken < pending) {
+			uint32_t used = pending - taken;
+			if (used > LOG_JOURNAL_DATA) used = LOG_JOURNAL_DATA;
+
+			uint8_t* sector = &jrnBuffer[sectors * 512];
+			Log_Peek(&sector[LOG_JOURNAL_HDR], taken, used);
+			Log_SealJournal(sector, used, jrnSeq + sectors);
+			taken += used;
+			sectors++;
+		}
+		if (sectors == 0) break;
+
+		fr = Log_StoreJournal(sectors);
+		if (fr != FR_OK) break;
+		Log_Consume(taken);
+	}
+
+	return fr;
+}
+
+// Hands length bytes at the front of the stream to f_write, splitting only where the ring wraps and
+// where the spilled bytes end; both go out in place, the spill area straight from flash
+static FRESULT Log_WriteOut(uint32_t length) {
+	FRESULT fr = FR_OK;
+	UINT bw;
+
+	while (length > 0) {
+		const uint8_t* data;
+		uint32_t part;
+#if LOG_SPILL
+		if (spillRead != spillWrite) {
+			data = Spill_Data() + spillRead;
+			part = spillWrite - spillRead;
+		} else
+#endif
+		{
+			uint32_t offset = tail & (LOG_RING_SIZE - 1);
+			data = &ring[offset];
+			part = LOG_RING_SIZE - offset;
+		}
+		if (part > length) part = length;
+
+		fr = Log_Store(data, part, &bw);
+
+		Log_Consume(bw);
+		stats.written += bw;
+		length -= bw;
+
+		if (fr != FR_OK) break;
+		if (bw < part) {
+			fr = FR_DENIED;																	// Volume full
+			break;
+		}
+	}
+
+	return fr;
+}
+
+// Consumer side; writes only chunks that end on a LOG_CHUNK_SIZE file offset so FatFs can stream whole sectors
+static FRESULT Log_Drain() {
+	FRESULT fr = FR_OK;
+
+	Log_Seal();																				// Before anything is spilled or written
+	if (logJournal) {
+		fr = Log_WriteJournal(0);
+		uint32_t now = HAL_GetTick();
+		if (Log_Available() == 0) jrnLastWrite = now;										// Flush age counts from the first waiting byte
+		else if (fr == FR_OK && now - jrnLastWrite >= LOG_JOURNAL_FLUSH_MS && !Log_Spill()) fr = Log_WriteJournal(1);
+		return fr;
+	}
+
+#if LOG_COMPRESS
+	if (logCompress) {
+		while (fr == FR_OK && Log_Available() >= LOG_FRAME_INPUT && !Log_Spill()) fr = Log_WriteFrame(LOG_FRAME_INPUT);
+		return fr;
+	}
+#endif
+
+	for (;;) {
+		uint32_t chunk = LOG_CHUNK_SIZE - (f_tell(&logFile) % LOG_CHUNK_SIZE);
+		if (Log_Available() < chunk || Log_Spill()) break;
+
+		fr = Log_WriteOut(chunk);
+		if (fr != FR_OK) break;
+	}
+
+	return fr;
+}
+
+FRESULT Log_Service() {
+	FRESULT fr;
+
+	if (!logOpen) return FR_NOT_ENABLED;
+
+	fr = Log_Drain();
+	if (fr == FR_OK) Log_SpillReclaim();
+	if (fr == FR_OK) fr = Log_Schedule();
+	return fr;
+}
+
+// Writes everything pending, including a partial chunk, and commits it
+FRESULT Log_Flush() {
+	FRESULT fr;
+
+	if (!logOpen) return FR_NOT_ENABLED;
+
+	fr = Log_Drain();
+	if (fr != FR_OK) return fr;
+
+	if (logJournal) {
+		fr = Log_WriteJournal(1);															// Short sector; never rewritten, the next data starts a new one
+	} else
+#if LOG_COMPRESS
+	if (logCompress) {
+		uint32_t n;
+		while (fr == FR_OK && (n = Log_Available()) > 0) {									// Last one short; the next frame starts a new sector
+			fr = Log_WriteFrame(n < LOG_FRAME_INPUT ? n : LOG_FRAME_INPUT);
+		}
+	} else
+#endif
+	{
+		fr = Log_WriteOut(Log_Available());
+	}
+	if (fr != FR_OK) return fr;
+
+	fr = Log_Commit();
+	if (fr == FR_OK) Log_SpillReclaim();
+	return fr;
+}
+
+// Gives the unused part of a contiguous extent back and closes the file; fr is the result so far
+static FRESULT Log_CloseFile(FRESULT fr) {
+	logOpen = 0;
+
+	if (fr == FR_OK && logRaw) {															// Give the unused part of the extent back
+		FSIZE_t end = logFile.fptr;
+		if (logJournal && end != 0) fr = Log_MarkJournal((uint32_t)(end / 512));			// A cut before the truncate leaks the tail, never frees it twice
+		if (fr == FR_OK) {
+			logFile.obj.objsize = rawExtent;
+			logFile.fptr = 0;																// Seek from the top; the FIL cluster field was never kept
+			fr = f_lseek(&logFile, end);
+			if (fr == FR_OK) fr = f_truncate(&logFile);
+		}
+	}
+	logRaw = 0;
+	logJournal = 0;
+
+	if (fr != FR_OK) {
+		f_close(&logFile);
+		return fr;
+	}
+
+	return f_close(&logFile);
+}
+
+FRESULT Log_Close() {
+	if (!logOpen) return FR_NOT_ENABLED;
+
+	return Log_CloseFile(Log_Flush());
+}
+
+// Closes the file at what has reached it and keeps everything else: producers go on pushing, and the next
+// open continues the stream with the ring, spill area and stats as they are. For a journal whose extent is
+// full (Log_Service returns FR_DENIED) ahead of Log_OpenJournal on the next file.
+FRESULT Log_Suspend() {
+	if (!logOpen) return FR_NOT_ENABLED;
+
+	logSuspended = 1;
+	return Log_CloseFile(Log_Commit());
+}
+
+// Writes data straight to the file ahead of everything pending, such as the schema at the top of a log
+// that continues a suspended stream. Not for compressed logs, whose readers expect nothing but frames.
+FRESULT Log_WriteHeader(const void* data, uint32_t length) {
+	const uint8_t* p = data;
+	FRESULT fr;
+	UINT bw;
+
+	if (!logOpen) return FR_NOT_ENABLED;
+	if (logCompress) return FR_INVALID_PARAMETER;
+
+	if (logJournal) {																		// Short sectors of their own; the ring starts a new one
+		while (length > 0) {
+			uint32_t sectors = 0;
+			while (sectors < LOG_CHUNK_SIZE / 512 && length > 0) {
+				uint32_t used = length < LOG_JOURNAL_DATA ? length : LOG_JOURNAL_DATA;
+				uint8_t* sector = &jrnBuffer[sectors * 512];
+				memcpy(&sector[LOG_JOURNAL_HDR], p, used);
+				Log_SealJournal(sector, used, jrnSeq + sectors);
+				p += used;
+				length -= used;
+				sectors++;
+			}
+			fr = Log_StoreJournal(sectors);
+			if (fr != FR_OK) return fr;
+		}
+		return FR_OK;
+	}
+
+	fr = Log_Store(p, length, &bw);
+	stats.written += bw;
+	if (fr == FR_OK && bw < length) fr = FR_DENIED;
+	return fr;
+}
+
+void Log_GetStats(Log_Stats* out) {
+	memcpy(out, (const void*)&stats, sizeof(*out));
+}
@@ -0,0 +1,95 @@
+// Read-back check of a recfmt log: f_read whole sectors, unwrap journal sectors and LZ frames, CRC every block
+// Blocks are checked with REC_HW_CRC, so on the board the CPU only walks the headers.
+#include <string.h>
+#include "logread.h"
+#include "logger.h"
+#include "recfmt.h"
+#include "lz.h"
+
+static uint8_t readFrame[LOG_CHUNK_SIZE];													// One sector, or one whole frame
+static uint8_t readStream[LOG_CHUNK_SIZE + REC_BLOCK_SIZE];									// Expanded bytes not yet cut into blocks
+
+static void LogRead_Block(LogRead_Report* report, const uint8_t* block, uint8_t first, uint32_t* expect) {
+	Rec_Schema schema;
+	uint32_t seq;
+
+	if (first) {																			// First logical sector is the schema
+		int check = Rec_ParseHeader(block, &schema);
+		report -> header = (check == 0);
+		if (check != 1) {
+			if (check == 2) report -> bad++;
+			return;
+		}
+	}
+
+	int check = Rec_CheckBlock(block, &seq);
+	if (check == 1) return;																	// Padding or preallocated space
+	if (check != 0) {
+		report -> bad++;
+		return;
+	}
+	if (report -> blocks && seq != *expect) report -> gaps++;
+	*expect = seq + 1;
+	report -> blocks++;
+}
+
+FRESULT LogRead_Verify(const char* path, LogRead_Report* report) {
+	FIL file;
+	FRESULT fr;
+	UINT br;
+	uint32_t have = 0, expect = 0, logical = 0, sectors;
+
+	memset(report, 0, sizeof(*report));
+	fr = f_open(&file, path, FA_READ);
+	if (fr != FR_OK) return fr;
+
+	while ((fr = f_read(&file, readFrame, REC_BLOCK_SIZE, &br)) == FR_OK && br == REC_BLOCK_SIZE) {
+		report -> sectors++;
+
+		Log_JournalHdr journal;
+		int32_t n;
+		int check = Log_CheckJournal(readFrame, &journal);
+		if (check != 1) {																	// Journal sector: only the payload is log data
+			report -> journal++;
+			if (check == 0) {
+				memcpy(&readStream[have], &readFrame[LOG_JOURNAL_HDR], journal.used);
+			} else {
+				report -> badFrames++;
+				memset(&readStream[have], 0, journal.used);									// Keeps the blocks after it aligned
+			}
+			n = journal.used;
+		} else if ((n = LZ_Unframe(readFrame, REC_BLOCK_SIZE, &readStream[have], LOG_CHUNK_SIZE, &sectors)) == 0) {
+			memcpy(&readStream[have], readFrame, REC_BLOCK_SIZE);
+			n = REC_BLOCK_SIZE;
+		} else {
+			report -> frames++;
+			if (sectors > 1) {
+				UINT rest = (sectors - 1) * REC_BLOCK_SIZE;
+				if (sectors * REC_BLOCK_SIZE > sizeof(readFrame)) {							// Length field itself is damaged
+					report -> badFrames++;
+					continue;
+				}
+				fr = f_read(&file, &readFrame[REC_BLOCK_SIZE], rest, &br);
+				if (fr != FR_OK || br != rest) break;
+				report -> sectors += sectors - 1;
+				n = LZ_Unframe(readFrame, sectors * REC_BLOCK_SIZE, &readStream[have], LOG_CHUNK_SIZE, &sectors);
+			}
+			if (n < 0) {																	// Zeros keep the blocks after it aligned
+				uint16_t length = readFrame[4] | (readFrame[5] << 8);
+				report -> badFrames++;
+				if (length > LOG_CHUNK_SIZE) continue;
+				memset(&readStream[have], 0, length);
+				n = length;
+			}
+		}
+		have += n;
+
+		uint32_t at = 0;
+		for (; at + REC_BLOCK_SIZE <= have; at += REC_BLOCK_SIZE) LogRead_Block(report, &readStream[at], logical++ == 0, &expect);
+		memmove(readStream, &readStream[at], have - at);
+		have -= at;
+	}
+
+	f_close(&file);
+	return fr;
+}
@@ -0,0 +1,181 @@
+// Small LZ77 codec in the LZ4 block layout: token (literal and match length nibbles), literals,
+// 16 bit offset, extra length bytes of 255. Matches are at least 4 bytes and the last 5 bytes
+// are always literals, so the decoder never reads a match past the end of its input.
+#include <string.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH		4
+#define LZ_LAST_LITERALS	5
+#define LZ_MATCH_LIMIT		12																// No match starts within this many bytes of the end
+
+static uint16_t lzHash[1 << LZ_HASH_BITS];													// Position + 1; 0 is empty
+
+static uint32_t LZ_Read32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t LZ_HashOf(uint32_t v) {
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Length continuation bytes after a nibble of 15
+static uint8_t* LZ_PutLength(uint8_t* op, uint32_t length) {
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+// One sequence; returns NULL when it would not fit below end
+static uint8_t* LZ_PutSequence(uint8_t* op, const uint8_t* end, const uint8_t* literals, uint32_t litLength,
+		uint16_t offset, uint32_t matchLength) {
+	if (op + 1 + litLength + litLength / 255 + 1 + (matchLength ? 2 + matchLength / 255 + 1 : 0) > end) return NULL;
+
+	uint8_t* token = op++;
+	*token = (litLength >= 15 ? 15 : litLength) << 4;
+	if (litLength >= 15) op = LZ_PutLength(op, litLength - 15);
+	memcpy(op, literals, litLength);
+	op += litLength;
+
+	if (matchLength) {
+		*op++ = offset;
+		*op++ = offset >> 8;
+		matchLength -= LZ_MIN_MATCH;
+		*token |= (matchLength >= 15) ? 15 : matchLength;
+		if (matchLength >= 15) op = LZ_PutLength(op, matchLength - 15);
+	}
+	return op;
+}
+
+// Compresses length bytes into at most capacity bytes; 0 when the result would not fit
+uint16_t LZ_Compress(const uint8_t* in, uint16_t length, uint8_t* out, uint16_t capacity) {
+	const uint8_t* end = out + capacity;
+	uint8_t* op = out;
+	uint32_t anchor = 0;
+	uint32_t ip = 0;
+
+	memset(lzHash, 0, sizeof(lzHash));
+
+	while (length > LZ_MATCH_LIMIT && ip < (uint32_t)length - LZ_MATCH_LIMIT) {
+		uint32_t sequence = LZ_Read32(&in[ip]);
+		uint32_t h = LZ_HashOf(sequence);
+		uint32_t ref = lzHash[h];
+		lzHash[h] = ip + 1;
+
+		if (ref == 0 || LZ_Read32(&in[ref - 1]) != sequence) {
+			ip++;
+			continue;
+		}
+		ref--;
+
+		uint32_t matchLength = LZ_MIN_MATCH;
+		while (ip + matchLength < (uint32_t)length - LZ_LAST_LITERALS && in[ref + matchLength] == in[ip + matchLength]) matchLength++;
+
+		op = LZ_PutSequence(op, end, &in[anchor], ip - anchor, ip - ref, matchLength);
+		if (!op) return 0;
+
+		ip += matchLength;
+		anchor = ip;
+	}
+
+	op = LZ_PutSequence(op, end, &in[anchor], length - anchor, 0, 0);						// Trailing literals
+	return op ? op - out : 0;
+}
+
+// Returns the decoded length, or -1 for input that is malformed or would overflow capacity
+int32_t LZ_Decompress(const uint8_t* in, uint16_t length, uint8_t* out, uint16_t capacity) {
+	const uint8_t* ip = in;
+	const uint8_t* iend = in + length;
+	uint8_t* op = out;
+	uint8_t* oend = out + capacity;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		uint32_t litLength = token >> 4;
+		if (litLength == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				litLength += b;
+			} while (b == 255);
+		}
+		if (litLength > (uint32_t)(iend - ip) || litLength > (uint32_t)(oend - op)) return -1;
+		memcpy(op, ip, litLength);
+		op += litLength;
+		ip += litLength;
+
+		if (ip == iend) break;																// Last sequence has no match
+
+		if (iend - ip < 2) return -1;
+		uint16_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - out) return -1;
+
+		uint32_t matchLength = token & 15;
+		if (matchLength == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend) return -1;
+				b = *ip++;
+				matchLength += b;
+			} while (b == 255);
+		}
+		matchLength += LZ_MIN_MATCH;
+		if (matchLength > (uint32_t)(oend - op)) return -1;
+
+		const uint8_t* match = op - offset;
+		while (matchLength--) *op++ = *match++;												// Byte copy; the regions may overlap
+	}
+
+	return op - out;
+}
+
+// Builds a frame in frame[], which needs LZ_FRAME_HDR + length bytes; returns the frame length before padding
+uint16_t LZ_Frame(const uint8_t* in, uint16_t length, uint8_t* frame) {
+	uint16_t packed = LZ_Compress(in, length, &frame[LZ_FRAME_HDR], length);
+	uint16_t flags = 0;
+
+	if (packed == 0 || packed >= length) {
+		memcpy(&frame[LZ_FRAME_HDR], in, length);
+		packed = length;
+		flags = LZ_FRAME_RAW;
+	}
+
+	frame[0] = LZ_FRAME_MAGIC & 0xFF;
+	frame[1] = LZ_FRAME_MAGIC >> 8;
+	frame[2] = flags;
+	frame[3] = flags >> 8;
+	frame[4] = length;
+	frame[5] = length >> 8;
+	frame[6] = packed;
+	frame[7] = packed >> 8;
+
+	return LZ_FRAME_HDR + packed;
+}
+
+// Decodes the frame at the start of data (available bytes); sets *sectors to the frame's 512 byte sectors.
+// Returns the decoded length, 0 when data does not start with a frame, -1 for a damaged frame.
+int32_t LZ_Unframe(const uint8_t* data, uint32_t available, uint8_t* out, uint16_t capacity, uint32_t* sectors) {
+	*sectors = 1;
+	if (available < LZ_FRAME_HDR || (data[0] | (data[1] << 8)) != LZ_FRAME_MAGIC) return 0;
+
+	uint16_t flags = data[2] | (data[3] << 8);
+	uint16_t length = data[4] | (data[5] << 8);
+	uint16_t packed = data[6] | (data[7] << 8);
+
+	*sectors = (LZ_FRAME_HDR + packed + 511) / 512;
+	if (LZ_FRAME_HDR + (uint32_t)packed > available || length > capacity) return -1;
+
+	if (flags & LZ_FRAME_RAW) {
+		if (packed != length) return -1;
+		memcpy(out, &data[LZ_FRAME_HDR], length);
+		return length;
+	}
+
+	return (LZ_Decompress(&data[LZ_FRAME_HDR], packed, out, capacity) == length) ? length : -1;
+}
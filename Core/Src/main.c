@@ -1,456 +1,255 @@
-// Used as reference for SD card commands https://chlazza.nfshost.com/sdcardinfo.html
 #include "main.h"
-#include <stdio.h>
 #include <string.h>
 #include "ff.h"
-
-// Prototypes
-void SPI_Init();
-void USART_Init();
-uint8_t SPI_Transfer(uint8_t);
-uint8_t SD_Init();
-void SD_PowerUp();
-uint8_t SD_SendCMD0();
-uint8_t SD_SendCMD8();
-uint8_t SD_SendCMD58();
-uint8_t SD_SendCMD55();
-uint8_t SD_SendACMD41();
-uint8_t SD_Card_Init();
-uint8_t SD_Init();
-uint8_t SD_TestBlockReadWrite();
+#include "diskio.h"
+#include "clock.h"
+#include "spi.h"
+#include "logger.h"
+#include "recfmt.h"
+#include "logread.h"
+#include "crc.h"
+#include "console.h"
+#include "profile.h"
+#include "bench.h"
+#include "volume.h"
 
 uint8_t buffer[512];
 
+// Schema written at the top of every log; producers call Record_Sample(channel, &value)
+static const Rec_Channel channels[] = {
+    { "sample", "raw", REC_U16 }
+};
+Rec_Encoder records;
+static volatile uint8_t recording;                                                  // Cleared while main owns the encoder
+static const char* logPath;
+static uint8_t logJournal;
+static BYTE work[FF_MAX_SS];                                                        // f_mkfs scratch
+
+// Each power cycle logs into a fresh journal; the previous one is kept as LOGDIR/Jnnnn.JNL
+#define JOURNAL_PATH        "LOGDIR/DATA.JNL"
+#define JOURNAL_EXTENT      (64UL << 20)
+
+static void Journal_Archive(uint32_t sectors) {
+    char name[24];
+    FILINFO info;
+
+    if (sectors == 0) {
+        f_unlink(JOURNAL_PATH);
+        return;
+    }
+
+    for (uint32_t n = 1; n < 10000; n++) {
+        Fmt_Snprintf(name, sizeof(name), "LOGDIR/J%04lu.JNL", n);
+        if (f_stat(name, &info) == FR_NO_FILE) {
+            f_rename(JOURNAL_PATH, name);
+            return;
+        }
+    }
+}
+
+// Called from the producers' interrupt handlers. Once main has cleared recording no handler can be
+// inside Rec_Add, since they all run to completion before main resumes.
+void Record_Sample(uint8_t channel, const void* value) {
+    if (recording) Rec_Add(&records, HAL_GetTick(), channel, value);
+}
+
+// Opens a fresh journal, or appends to DATA.BIN when no free run is long enough; fresh when the file is empty
+static FRESULT Log_OpenNext(uint8_t* fresh) {
+    FRESULT fr;
+
+    *fresh = 1;
+    logPath = JOURNAL_PATH;
+    logJournal = 1;
+    fr = Log_OpenJournal(JOURNAL_PATH, JOURNAL_EXTENT);
+    if (fr != FR_OK) {                                                              // No free run that long; plain appending log
+        FILINFO info;
+        logPath = "LOGDIR/DATA.BIN";
+        logJournal = 0;
+        *fresh = (f_stat(logPath, &info) != FR_OK || info.fsize == 0);
+        fr = Log_Open(logPath);
+    }
+    return fr;
+}
+
+// Opens the log and starts the record stream
+static FRESULT Log_Start() {
+    uint8_t fresh;
+    FRESULT fr = Log_OpenNext(&fresh);
+    if (fr != FR_OK) return fr;
+
+    Rec_Begin(&records, channels, sizeof(channels) / sizeof(channels[0]), 1000, Log_Push);
+    Rec_DeferSeal(&records);                                                        // Log_Service seals with the CRC unit
+    if (fresh) Rec_WriteHeader(&records);                                           // Appended runs reuse the existing schema
+    return FR_OK;
+}
+
+// The extent is full: the journal is closed as it stands and archived as at power-up, and the stream
+// goes on in the next file behind a copy of the schema. Producers keep recording; nothing pending is lost.
+static FRESULT Journal_Rotate() {
+    static uint8_t header[REC_BLOCK_SIZE];
+    Log_Recovery recovery;
+    uint8_t fresh;
+    FRESULT fr;
+
+    Log_Suspend();                                                                  // A failed commit is left to the recovery below
+    if (Log_RecoverJournal(JOURNAL_PATH, &recovery) == FR_OK) {
+        Journal_Archive(recovery.committed + recovery.recovered);
+    }
+    Fmt_Printf("Journal full, %lu bytes carried over\r\n", (unsigned long)Log_Pending());
+
+    fr = Log_OpenNext(&fresh);
+    if (fr == FR_OK && fresh) {
+        Rec_BuildHeader(&records, header);
+        Rec_Seal(header);                                                           // The ring seals only what was pushed
+        fr = Log_WriteHeader(header, sizeof(header));
+    }
+    return fr;
+}
+
 int main() {
     FATFS fs;
     FIL file;
     FRESULT fr;
     UINT bw;
 
+    HAL_Init();
+    Clock_Init();
+    Prof_Init();
+    Crc_Init();                                                                     // recfmt seals every block with the CRC unit
+
     SPI_Init();
-    USART_Init();
+    SPI_DMA_Init();
+    Console_Init();
     for (volatile int i = 0; i < 10000; i++);
-    printf("Starting...\r\n");
+    Fmt_Printf("Starting...\r\n");
 
     f_mount(NULL, "", 0);
 
     fr = f_mount(&fs, "", 1);
+    if (fr == FR_NO_FILESYSTEM) {                                                   // Blank card: format it for its AU
+        Fmt_Printf("Formatting...\r\n");
+        fr = Vol_Format("", work, sizeof(work));
+        if (fr == FR_OK) fr = f_mount(&fs, "", 1);
+    }
     if (fr != FR_OK) {
-        printf("Mount failed: %d\r\n", fr);
+        Fmt_Printf("Mount failed: %d\r\n", fr);
         while(1);
     }
-    printf("Mount successful\r\n");
+    Fmt_Printf("Mount successful\r\n");
+
+    Vol_Layout layout;
+    if (Vol_GetLayout(&fs, &layout) == FR_OK) {
+        Fmt_Printf("Volume: %lu sectors, cluster %lu, data at %lu, AU %lu sectors, %s\r\n", (DWORD)layout.sectors,
+                layout.cluster, (DWORD)layout.data, layout.block, layout.aligned ? "aligned" : "misaligned");
+#if VOL_REFORMAT_MISALIGNED
+        if (!layout.aligned) {
+            Fmt_Printf("Reformatting...\r\n");
+            f_mount(NULL, "", 0);
+            fr = Vol_Format("", work, sizeof(work));
+            if (fr == FR_OK) fr = f_mount(&fs, "", 1);
+            if (fr != FR_OK) {
+                Fmt_Printf("Reformat failed: %d\r\n", fr);
+                while(1);
+            }
+        }
+#endif
+    }
+
+    FATFS* volume;
+    DWORD freeClusters;
+    if (f_getfree("", &freeClusters, &volume) == FR_OK) {                          // One FAT pass; also builds the free cluster map
+        Fmt_Printf("%lu clusters free\r\n", freeClusters);
+    }
+
+#ifdef BENCHMARK
+    Bench_Run();                                                                    // Benchmark build; the logger never starts
+    f_mount(NULL, "", 0);
+    while(1);
+#endif
 
     // Create test directory
     fr = f_mkdir("LOGDIR");
     if (fr == FR_OK || fr == FR_EXIST) {
-        printf("Directory created or exists\r\n");
+        Fmt_Printf("Directory created or exists\r\n");
     }
 
     char filename[64];
-    sprintf(filename, "LOGDIR/TEST.TXT");
+    Fmt_Snprintf(filename, sizeof(filename), "LOGDIR/TEST.TXT");
 
     fr = f_open(&file, filename, FA_WRITE | FA_CREATE_ALWAYS);
     if (fr != FR_OK) {
-        printf("File creation failed: %d\r\n", fr);
+        Fmt_Printf("File creation failed: %d\r\n", fr);
         f_mount(NULL, "", 0);
         while(1);
     }
 
     const char *text = "Test file\r\n";
+    PROF_BEGIN(tw);
     fr = f_write(&file, text, strlen(text), &bw);
+    PROF_END(PROF_F_WRITE, tw);
     if (fr != FR_OK) {
-        printf("Write failed: %d\r\n", fr);
+        Fmt_Printf("Write failed: %d\r\n", fr);
     }
 
+    PROF_BEGIN(ts);
     f_sync(&file);
+    PROF_END(PROF_F_SYNC, ts);
     f_close(&file);
 
-    f_mount(NULL, "", 0);
-
-    printf("All operations complete\r\n");
-    while(1);
-}
-
-void USART_Init() {
-	RCC -> APB1ENR |= (1 << 17);															// USART2 Clock
-	RCC -> AHB1ENR |= (1 << 0);																// GPIOA Clock; should be already enabled
-
-	GPIOA -> MODER &= ~((3 << (2 * 2)) | (3 << (2 * 3)));									// PA2 & PA3 to Alternate Function
-	GPIOA -> MODER |= (2 << (2 * 2)) | (2 << (2 * 3));
-
-	GPIOA -> AFR[0] |= (7 << (4 * 2)) | (7 << (4 * 3));										// Sets alternate function for USART2
-
-	USART2 -> BRR = 0x0683;																	// Baud rate set to 9600
-
-	USART2 -> CR1 |= (1 << 2) | (1 << 3);													// Receiver & Transmitter Enabled
-	USART2 -> CR1 |= (1 << 13);																// USART2 Enabled
-}
-
-int __io_putchar(int c) {
-	while(!(USART2 -> SR & (1 << 7)));
-	USART2 -> DR = c;
-
-	while(!(USART2 -> SR & (1 << 6)));
-	USART2 -> SR &= ~(1 << 6);
-	return c;
-}
-
-void SPI_Init() {
-	RCC -> AHB1ENR |= (1 << 0);															// GPOPA Clock
-	RCC -> AHB1ENR |= (1 << 1);															// GPOPB Clock
-	RCC -> APB2ENR |= (1 << 12);														// SPI1 Clock
-
-	GPIOB -> MODER &= ~(3 << (2 * 6));													// PB6 for output/SD card and generates a high signal; bit amount * pin number
-	GPIOB -> MODER |= (1 << (2 * 6));
-	GPIOB -> ODR |= (1 << 6);
-
-	GPIOA -> MODER &= ~((3 << (2 * 5)) | (3 << (2 * 6)) | (3 << (2 * 7))); 				// PA5, PA6 & PA7 set for Alternate Function
-	GPIOA -> MODER |= ((2 << (2 * 5)) | (2 << (2 * 6)) | (2 << (2 * 7)));
-
-	GPIOA->PUPDR &= ~(3 << (2 * 6));  													// Set pull-up
-	GPIOA->PUPDR |= (1 << (2 * 6));
-
-	GPIOA -> AFR[0] &= ~((15 << (4 * 5)) | (15 << (4 * 6)) | (15 << (4 * 7)));			// PA5, PA6 & PA7 set for AFR5; SPI1
-	GPIOA -> AFR[0] |= (5 << (4 * 5)) | (5 << (4 * 6)) | (5 << (4 * 7));
-
-	SPI1 -> CR1 = 0;																	// Resets SPI1
-	SPI1 -> CR1 |= (1 << 2);															// Sets Master mode
-	SPI1 -> CR1 |= (7 << 3);															// /256 for initialization of SD card
-	SPI1 -> CR1 |= (1 << 8);															// Used to select any pin for NSS instead of hardware
-	SPI1 -> CR1 |= (1 << 9);															// Enables SSM
-	SPI1 -> CR1 |= (1 << 6);															// SPI1 Enable
-}
-
-// Actual SPI Data Transfer
-uint8_t SPI_Transfer(uint8_t data) {
-    while(!(SPI1->SR & (1 << 1)));    													// Waits for TXE bit
-    SPI1->DR = data;                  													// Sends data from register
-    while(!(SPI1->SR & (1 << 0)));   													// Wait for RXNE bit
-    return SPI1->DR;                  													// Returns the received byte
-}
-
-void SD_Select() {
-	GPIOB -> ODR &= ~(1 << 6);															// Generates a low output
-}
-
-void SD_Deselect() {
-	GPIOB -> ODR |= (1 << 6);															// Generates a high output
-}
-
-// Allows the SD card to be put into SPI mode
-void SD_PowerUp() {
-	for (int i = 0; i < 10; i++) {
-		SPI_Transfer(0xFF);																// Creates 8 clock pulses each iteration, needs about 74 to ensure wake up
-	}
-}
-
-// Puts SD card into SPI mode, brings it to an idle state and returns response code
-uint8_t SD_SendCMD0() {
-    printf("Starting CMD0\r\n");
-    SPI_Transfer(0xFF);
-
-    SD_Select();
-    printf("CS Low\r\n");
-
-    SPI_Transfer(0x40);
-    SPI_Transfer(0x00);
-    SPI_Transfer(0x00);
-    SPI_Transfer(0x00);
-    SPI_Transfer(0x00);
-    SPI_Transfer(0x95);
-    printf("CMD0 sent\r\n");
-
-    uint8_t response;
-    for (int i = 0; i < 10; i++) {
-        response = SPI_Transfer(0xFF);
-        printf("Try %d: 0x%02X\r\n", i, response);
-        if (response != 0xFF) break;
+    Log_Recovery recovery;
+    if (Log_RecoverJournal(JOURNAL_PATH, &recovery) == FR_OK) {                    // Left open by the last power cycle
+        Fmt_Printf("Journal: %lu committed, %lu recovered sectors\r\n", recovery.committed, recovery.recovered);
+        Journal_Archive(recovery.committed + recovery.recovered);
     }
 
-    SD_Deselect();
-    return response;
-}
-
-// Checks if SD card can operate at current device voltage; required for v2+
-// Implement error checking to make sure the check pattern and voltage is enough
-uint8_t SD_SendCMD8() {
-
-	SPI_Transfer(0xFF);
-
-	SD_Select();
-
-	SPI_Transfer(0x48);																	// CMD8
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x01);																	// Voltage level 2.7-3.6V
-	SPI_Transfer(0xAA);																	// Check pattern
-	SPI_Transfer(0x87);																	// CRC
-
-	uint8_t response[5];																// R7 Format - Returns voltage info and check pattern
-
-	for (int i = 0; i < 5; i++) {
-		response[i] = SPI_Transfer(0xFF);
-	}
-
-	SD_Deselect();																		// Deselects SD card and runs a cycle
-	SPI_Transfer(0xFF);
-
-	printf("CMD8: %d\r\n",response[1]);
-	return response[1];																	// Should be 0x01 if successful
-}
-
-// Returns a 5 byte response containing voltage and capacity information
-uint8_t SD_SendCMD58() {
-
-	SPI_Transfer(0xFF);
-
-	SD_Select();
-
-	SPI_Transfer(0x7A);    																// CMD58
-	SPI_Transfer(0x00);    																// Reserved
-	SPI_Transfer(0x00);    																// Reserved
-	SPI_Transfer(0x00);    																// Reserved
-	SPI_Transfer(0x00);    																// Reserved
-	SPI_Transfer(0xFF);    																// No CRC required
-
-	uint8_t response[5];
-
-	for (int i = 0; i < 5; i++) {
-		response[i] = SPI_Transfer(0xFF);
-	}
-
-	SD_Deselect();
-	SPI_Transfer(0xFF);
-
-	return response[0];																	// Should be 0x01
-}
-
-// Tells card that next command is application specific
-// Implement error checking
-uint8_t SD_SendCMD55() {
-
-	SPI_Transfer(0xFF);
-
-	SD_Select();
-
-	SPI_Transfer(0x77);																	// CMD55
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0xFF);																	// No CRC required
-
-	uint8_t response;
-
-	for (int i = 0; i < 10; i++) {
-		response = SPI_Transfer(0xFF);
-		if (response != 0xFF) break;
-		for (volatile int j = 0; j < 10000; j++);
-	}
-
-	SD_Deselect();
-	SPI_Transfer(0xFF);
-
-	printf("CMD55: %d\r\n",response);
-	return response;																	// Should be 0x01
-}
-
-// Activates SD card initialization process; must follow CMD55 for each attempt
-uint8_t SD_SendACMD41() {
-
-	SPI_Transfer(0xFF);
-
-	SD_Select();
-
-	SPI_Transfer(0x69);																	// ACMD41
-	SPI_Transfer(0x40);																	// HCS bit
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0x00);																	// Reserved
-	SPI_Transfer(0xFF);																	// No CRC required
-
-	uint8_t response;
-
-	for (int i = 0; i < 50; i++) {
-		response = SPI_Transfer(0xFF);
-		if (response != 0xFF) break;
-		for (volatile int j = 0; j < 100000; j++);
-	}
-
-	SD_Deselect();
-	SPI_Transfer(0xFF);
-
-	printf("ACMD41: %d\r\n",response);
-	return response;
-}
-
-// Initializes the SD card and keeps sending the commands until initialization completes
-uint8_t SD_Card_Init() {
-	uint8_t response;
-
-	do {
-		response = SD_SendCMD55();
-		if (response != 0x01) return response;
-
-		response = SD_SendACMD41();
-	} while (response == 0x01);
-
-	return response;
-}
-
-// Full SD card setup
-uint8_t SD_Init() {
-	uint8_t response;
-
-	SD_PowerUp();
-
-	response = SD_SendCMD0();
-	if(response != 0x01) return response;
-
-	response = SD_SendCMD8();
-	if (response != 0x01) return response;
-
-	response = SD_Card_Init();
-	if (response != 0x00) return response;
-
-	return 0;
-}
-
-// Gets a block to read; Sends CMD17 to the SD card with the MSB -> LSB in bytes
-uint8_t SD_ReadBlock(uint32_t blockAddress, uint8_t* buffer) {
-    uint8_t response;
-    uint16_t timeout;
-
-    SD_Select();
-
-    SPI_Transfer(0x51);
-    SPI_Transfer((blockAddress >> 24) & 0xFF);
-    SPI_Transfer((blockAddress >> 16) & 0xFF);
-    SPI_Transfer((blockAddress >> 8) & 0xFF);
-    SPI_Transfer(blockAddress & 0xFF);
-    SPI_Transfer(0xFF);
-
-    timeout = 100;
-    do {
-        response = SPI_Transfer(0xFF);
-        timeout--;
-    } while (response == 0xFF && timeout > 0);
-
-    if (response != 0x00) {
-        printf("Read cmd response error: %02X\r\n", response);
-        SD_Deselect();
-        return 1;
-    }
-
-    timeout = 5000;
-    do {
-        response = SPI_Transfer(0xFF);
-        timeout--;
-    } while (response == 0xFF && timeout > 0);
-
-    if (response != 0xFE) {
-        printf("No data token: %02X\r\n", response);
-        SD_Deselect();
-        return 2;
+    Log_SetSpill(1);                                                                // Card stalls go to flash sector 7; erased here if used
+    Log_SetSeal(1);                                                                 // Blocks arrive unsealed from the handlers
+    fr = Log_Start();
+    if (fr != FR_OK) {
+        Fmt_Printf("Log open failed: %d\r\n", fr);
+        f_mount(NULL, "", 0);
+        while(1);
     }
-
-    for(int i = 0; i < 512; i++) {
-        buffer[i] = SPI_Transfer(0xFF);
+    recording = 1;
+    Fmt_Printf("Logging started\r\n");
+
+    FRESULT logError = FR_OK;
+    while(1) {
+        fr = Log_Service();                                                         // Producers push from their interrupt handlers
+        if (fr == FR_DENIED && logJournal) fr = Journal_Rotate();
+        if (fr != logError) {                                                       // Reported once, not on every pass
+            if (fr != FR_OK) Fmt_Printf("Log write failed: %d\r\n", fr);
+            logError = fr;
+        }
+
+        switch (Console_GetChar()) {
+            case 'p': {                                                             // Latency histograms on demand
+                DCACHE_STATS cache;
+                Log_Stats log;
+                Prof_Dump();
+                disk_cache_stats(&cache);
+                Fmt_Printf("cache,hits,%lu,misses,%lu,absorbed,%lu,writebacks,%lu,evictions,%lu\r\n",
+                        cache.hits, cache.misses, cache.absorbed, cache.writebacks, cache.evictions);
+                Log_GetStats(&log);
+                Fmt_Printf("sync,count,%lu,deferred,%lu,last_ms,%lu,max_ms,%lu,mean_ms,%lu,scale,%lu\r\n",
+                        log.commits, log.syncDeferred, log.syncMsLast, log.syncMsMax,
+                        log.commits ? log.syncMsTotal / log.commits : 0, log.syncScale);
+                Fmt_Printf("spill,bytes,%lu,max,%lu,full,%lu,erases,%lu,errors,%lu,pending,%lu\r\n",
+                        log.spilled, log.spillMax, log.spillFull, log.spillErases, log.spillErrors, Log_Pending());
+                break;
+            }
+            case 'r': Prof_Reset(); disk_cache_reset_stats(); break;
+            case 'v': {                                                             // Reads the log back and checks every block CRC
+                LogRead_Report report;
+                recording = 0;                                                      // Rec_Flush shares the block with Rec_Add
+                Rec_Flush(&records);
+                recording = 1;
+                Log_Flush();
+                fr = LogRead_Verify(logPath, &report);
+                Fmt_Printf("verify,%d,sectors,%lu,blocks,%lu,bad,%lu,gaps,%lu,frames,%lu,bad_frames,%lu\r\n", fr,
+                        report.sectors, report.blocks, report.bad, report.gaps, report.frames, report.badFrames);
+                break;
+            }
+        }
     }
-
-    SPI_Transfer(0xFF);
-    SPI_Transfer(0xFF);
-
-    SPI_Transfer(0xFF);
-
-    SD_Deselect();
-
-    return 0;
-}
-
-// Gets a block to write to; Sends CMD24 to the SD card with the MSB -> LSB in bytes
-uint8_t SD_WriteBlock(uint32_t blockAddress, const uint8_t* buffer) {
-	uint8_t response;
-	uint16_t retry = 0;
-
-	SD_Select();
-
-	SPI_Transfer(0x58);
-	SPI_Transfer((blockAddress >> 24) & 0xFF);
-	SPI_Transfer((blockAddress >> 16) & 0xFF);
-	SPI_Transfer((blockAddress >> 8) & 0xFF);
-	SPI_Transfer(blockAddress & 0xFF);
-
-	SPI_Transfer(0xFF);
-
-	do {
-		response = SPI_Transfer(0xFF);
-		retry++;
-	} while (response == 0xFF && retry < 1000);
-
-	if (response != 0x00) {
-		SD_Deselect();
-		return response;
-	}
-
-	SPI_Transfer(0xFE);
-
-	for (uint16_t i = 0; i < 512; i++) {
-	        SPI_Transfer(buffer[i]);
-	}
-
-	SPI_Transfer(0xFF);
-	SPI_Transfer(0xFF);
-
-	response = SPI_Transfer(0xFF);
-	if ((response & 0x1F) != 0x05) {
-		SD_Deselect();
-		return response;
-	}
-
-	retry = 0;
-	do {
-		response = SPI_Transfer(0xFF);
-		retry++;
-	} while (response == 0x00 && retry < 1000);
-
-	SD_Deselect();
-
-	return 0x00;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
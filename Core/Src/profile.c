@@ -0,0 +1,51 @@
+// Latency histograms for the storage stack, timed with the DWT cycle counter
+#ifndef HOST_BUILD
+#include "main.h"
+#endif
+#include <string.h>
+#include "console.h"
+#include "profile.h"
+
+#if PROFILE_ENABLE
+
+Prof_Histogram profHist[PROF_COUNT];
+
+static const char* const profNames[PROF_COUNT] = {
+	"SD_ReadBlock", "SD_ReadMultiBlock", "SD_WriteBlock", "SD_WriteMultiBlock", "SD busy",
+	"disk_read", "disk_write", "disk_ioctl", "f_write", "f_sync", "LZ_Frame", "Rec_Seal"
+};
+
+void Prof_Init() {
+#ifndef HOST_BUILD
+	CoreDebug -> DEMCR |= (1 << 24);														// TRCENA; powers the DWT
+	DWT -> CYCCNT = 0;
+	DWT -> CTRL |= (1 << 0);																// CYCCNTENA
+#endif
+
+	Prof_Reset();
+}
+
+void Prof_Reset() {
+	memset(profHist, 0, sizeof(profHist));
+}
+
+// One line per probe with count, mean and max in microseconds, then the non-empty log2 buckets
+void Prof_Dump() {
+	uint32_t cyclesPerUs = PROF_TICKS_PER_US;
+
+	Fmt_Printf("probe,count,mean_us,max_us,buckets(log2 cycles:count)\r\n");
+	for (int id = 0; id < PROF_COUNT; id++) {
+		Prof_Histogram* h = &profHist[id];
+		if (h -> count == 0) continue;
+
+		Fmt_Printf("%s,%lu,%lu,%lu,", profNames[id], (unsigned long)h -> count,
+			   (unsigned long)((uint32_t)(h -> total / h -> count) / cyclesPerUs), (unsigned long)(h -> max / cyclesPerUs));
+
+		for (int b = 0; b < PROF_BUCKETS; b++) {
+			if (h -> bucket[b]) Fmt_Printf(" %d:%lu", b, (unsigned long)h -> bucket[b]);
+		}
+		Fmt_Printf("\r\n");
+	}
+}
+
+#endif
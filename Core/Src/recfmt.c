@@ -0,0 +1,209 @@
+// Binary log records: schema header, sealed blocks with sequence and CRC, varint delta timestamps
+// Encoding is one varint and one value copy per record; nothing is formatted on the device.
+#include <string.h>
+#include "recfmt.h"
+
+const uint8_t recTypeSize[REC_TYPES] = { 1, 1, 2, 2, 4, 4, 4 };
+
+// CRC-32/MPEG-2 (poly 0x04C11DB7, init all ones, no reflection) over little endian words; a nibble at a time.
+// Reference and host version; the target seals and checks blocks with the CRC unit from thread context.
+uint32_t Rec_CRC32(const uint8_t* data, uint32_t words) {
+	static const uint32_t nibble[16] = {
+		0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+		0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD
+	};
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (words--) {
+		crc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		data += 4;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc << 4) ^ nibble[crc >> 28];
+		}
+	}
+
+	return crc;
+}
+
+static void Rec_Put16(uint8_t* p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void Rec_Put32(uint8_t* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint16_t Rec_Get16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t Rec_Get32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Fills in the CRC word of a header or block
+void Rec_Seal(uint8_t* sector) {
+	Rec_Put32(&sector[REC_BLOCK_SIZE - 4], REC_CRC(sector, (REC_BLOCK_SIZE - 4) / 4));
+}
+
+void Rec_Begin(Rec_Encoder* enc, const Rec_Channel* channels, uint8_t count, uint32_t tickHz, Rec_Output output) {
+	memset(enc, 0, sizeof(*enc));
+	enc -> channels = channels;
+	enc -> count = (count > REC_MAX_CHANNELS) ? REC_MAX_CHANNELS : count;
+	enc -> tickHz = tickHz;
+	enc -> output = output;
+}
+
+// Blocks are handed to the output with the CRC word still open, so Rec_Add stays cheap in an interrupt
+// handler; the output must Rec_Seal every 512-byte unit before it is stored, as a log opened after
+// Log_SetSeal(1) does in Log_Service
+void Rec_DeferSeal(Rec_Encoder* enc) {
+	enc -> deferSeal = 1;
+}
+
+// Schema sector with the CRC word open; reads only what Rec_Begin set, so it is safe next to Rec_Add
+void Rec_BuildHeader(const Rec_Encoder* enc, uint8_t* h) {
+	memset(h, 0, REC_BLOCK_SIZE);
+	Rec_Put32(&h[0], REC_FILE_MAGIC);
+	Rec_Put16(&h[4], REC_VERSION);
+	h[6] = enc -> count;
+	Rec_Put32(&h[8], enc -> tickHz);
+	Rec_Put16(&h[12], REC_BLOCK_SIZE);
+	for (int i = 0; i < enc -> count; i++) {
+		uint8_t* c = &h[16 + i * 24];
+		memcpy(&c[0], enc -> channels[i].name, REC_NAME_LEN);
+		memcpy(&c[12], enc -> channels[i].unit, REC_UNIT_LEN);
+		c[20] = enc -> channels[i].type;
+	}
+}
+
+// Emits the schema sector; once per file, before any block
+uint8_t Rec_WriteHeader(Rec_Encoder* enc) {
+	uint8_t* h = enc -> block;																// Free until the first record
+
+	Rec_BuildHeader(enc, h);
+	if (!enc -> deferSeal) Rec_Seal(h);
+
+	uint8_t res = enc -> output(h, REC_BLOCK_SIZE);
+	memset(h, 0, REC_BLOCK_SIZE);
+	return res;
+}
+
+// Seals the current block and hands it to the output; an empty block is not emitted
+static uint8_t Rec_Emit(Rec_Encoder* enc, uint16_t flags) {
+	uint8_t* b = enc -> block;
+
+	if (enc -> records == 0) return 0;
+
+	Rec_Put16(&b[0], REC_BLOCK_MAGIC);
+	Rec_Put16(&b[2], enc -> records);
+	Rec_Put32(&b[4], enc -> seq++);
+	Rec_Put16(&b[12], enc -> fill);
+	Rec_Put16(&b[14], flags);
+	memset(&b[REC_HDR_SIZE + enc -> fill], 0, REC_PAYLOAD_SIZE - enc -> fill);
+	if (!enc -> deferSeal) Rec_Seal(b);
+
+	uint8_t res = enc -> output(b, REC_BLOCK_SIZE);
+	if (res) enc -> dropped++;
+
+	enc -> fill = 0;
+	enc -> records = 0;
+	return res;
+}
+
+// Producer side; one record is a varint of the ticks since the previous record, the channel and its value
+uint8_t Rec_Add(Rec_Encoder* enc, uint32_t timestamp, uint8_t channel, const void* value) {
+	if (channel >= enc -> count) return 1;
+
+	uint8_t size = recTypeSize[enc -> channels[channel].type];
+	uint32_t delta = timestamp - enc -> last;
+
+	if (enc -> records && REC_PAYLOAD_SIZE - enc -> fill < 5 + 1 + size) Rec_Emit(enc, 0);	// Worst case varint
+	if (enc -> records == 0) {
+		Rec_Put32(&enc -> block[8], timestamp);												// Base timestamp; the first delta is 0
+		delta = 0;
+	}
+
+	uint8_t* p = &enc -> block[REC_HDR_SIZE + enc -> fill];
+	uint8_t* start = p;
+	while (delta >= 0x80) {
+		*p++ = (delta & 0x7F) | 0x80;
+		delta >>= 7;
+	}
+	*p++ = delta;
+	*p++ = channel;
+	memcpy(p, value, size);																	// Little endian on the Cortex-M4
+	p += size;
+
+	enc -> fill += p - start;
+	enc -> records++;
+	enc -> last = timestamp;
+	return 0;
+}
+
+// Seals a partly filled block; call from the producer's context or with the producer stopped
+uint8_t Rec_Flush(Rec_Encoder* enc) {
+	return Rec_Emit(enc, REC_FLAG_PADDED);
+}
+
+// 0 when the sector is a valid header of a version this code reads
+int Rec_ParseHeader(const uint8_t* h, Rec_Schema* out) {
+	if (Rec_Get32(&h[0]) != REC_FILE_MAGIC) return 1;
+	if (Rec_Get32(&h[REC_BLOCK_SIZE - 4]) != REC_CRC(h, (REC_BLOCK_SIZE - 4) / 4)) return 2;
+
+	out -> version = Rec_Get16(&h[4]);
+	out -> count = h[6];
+	out -> tickHz = Rec_Get32(&h[8]);
+	if (out -> version != REC_VERSION || out -> count > REC_MAX_CHANNELS || Rec_Get16(&h[12]) != REC_BLOCK_SIZE) return 3;
+
+	for (int i = 0; i < out -> count; i++) {
+		const uint8_t* c = &h[16 + i * 24];
+		memcpy(out -> channels[i].name, &c[0], REC_NAME_LEN);
+		memcpy(out -> channels[i].unit, &c[12], REC_UNIT_LEN);
+		out -> channels[i].type = c[20];
+		if (c[20] >= REC_TYPES) return 3;
+	}
+	return 0;
+}
+
+// 0 for an intact block, 1 for no block magic, 2 for a CRC mismatch; seq is filled in either way
+int Rec_CheckBlock(const uint8_t* b, uint32_t* seq) {
+	*seq = Rec_Get32(&b[4]);
+	if (Rec_Get16(&b[0]) != REC_BLOCK_MAGIC) return 1;
+	if (Rec_Get32(&b[REC_BLOCK_SIZE - 4]) != REC_CRC(b, (REC_BLOCK_SIZE - 4) / 4)) return 2;
+	return 0;
+}
+
+// Streams the records of a checked block into sink; returns the record count, or -1 if the payload is malformed
+int Rec_DecodeBlock(const Rec_Schema* hdr, const uint8_t* b, Rec_Sink sink, void* ctx) {
+	uint16_t records = Rec_Get16(&b[2]);
+	uint16_t fill = Rec_Get16(&b[12]);
+	uint32_t timestamp = Rec_Get32(&b[8]);
+	const uint8_t* p = &b[REC_HDR_SIZE];
+	const uint8_t* end = p + fill;
+
+	if (fill > REC_PAYLOAD_SIZE) return -1;
+
+	for (int n = 0; n < records; n++) {
+		uint32_t delta = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (p >= end || shift > 28) return -1;
+			delta |= (uint32_t)(*p & 0x7F) << shift;
+			if (!(*p++ & 0x80)) break;
+		}
+		if (p >= end || *p >= hdr -> count) return -1;
+
+		uint8_t channel = *p++;
+		uint8_t size = recTypeSize[hdr -> channels[channel].type];
+		if (p + size > end) return -1;
+
+		timestamp += delta;
+		sink(ctx, timestamp, channel, p);
+		p += size;
+	}
+	return records;
+}
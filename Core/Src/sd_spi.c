@@ -0,0 +1,780 @@
+// SD card protocol over SPI; used as reference for SD card commands https://chlazza.nfshost.com/sdcardinfo.html
+// Everything below talks to the card through spi.h only.
+#include <stdint.h>
+#include <stddef.h>
+#include "spi.h"
+#include "clock.h"
+#include "sd_spi.h"
+#include "console.h"
+#include "profile.h"
+
+static volatile uint8_t sdBusy = 0;														// Card may still be programming the last write
+static uint32_t sdTokenTimeout = 5000;														// Data token polls; rescaled with the SPI clock
+static uint32_t sdBusyTimeout = 10000;														// Programming busy polls; rescaled with the SPI clock
+static const uint32_t csdRateUnit[4] = {10000, 100000, 1000000, 10000000};				// TRAN_SPEED rate unit divided by 10
+static const uint8_t csdTimeValue[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};	// TRAN_SPEED time value times 10
+static const uint32_t statusAUSectors[16] = {0, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 24576, 32768, 49152, 65536, 131072};	// AU_SIZE 16 KB to 64 MB
+
+// Token and busy polls are counted in bytes, so their limits follow the SPI clock
+static void SD_SetTimeouts(uint32_t spiClock) {
+	sdTokenTimeout = spiClock / 32;														// About 250 ms worth of polled bytes
+	if (sdTokenTimeout < 5000) sdTokenTimeout = 5000;
+	sdBusyTimeout = spiClock / 16;														// 500 ms, the SDHC/SDXC write busy limit
+	if (sdBusyTimeout < 10000) sdBusyTimeout = 10000;
+}
+
+// Every command starts here, so a write's deferred busy is paid only when the card is needed again.
+// Returns SD_BUSY_ERROR, deselected and still marked busy, when the card does not finish in time.
+uint8_t SD_Select() {
+	SPI_Select();
+
+	if (sdBusy) {
+		if (SD_WaitReady() != 0xFF) {
+			SD_Deselect();
+			return SD_BUSY_ERROR;
+		}
+		sdBusy = 0;
+	}
+	return 0;
+}
+
+void SD_Deselect() {
+	SPI_Deselect();
+}
+
+// Allows the SD card to be put into SPI mode
+void SD_PowerUp() {
+	for (int i = 0; i < 10; i++) {
+		SPI_Transfer(0xFF);																// Creates 8 clock pulses each iteration, needs about 74 to ensure wake up
+	}
+}
+
+// Puts SD card into SPI mode, brings it to an idle state and returns response code
+uint8_t SD_SendCMD0() {
+    CON_TRACE("Starting CMD0\r\n");
+    SPI_Transfer(0xFF);
+
+    SD_Select();
+    CON_TRACE("CS Low\r\n");
+
+    SPI_Transfer(0x40);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x95);
+    CON_TRACE("CMD0 sent\r\n");
+
+    uint8_t response;
+    for (int i = 0; i < 10; i++) {
+        response = SPI_Transfer(0xFF);
+        CON_TRACE("Try %d: 0x%02X\r\n", i, response);
+        if (response != 0xFF) break;
+    }
+
+    SD_Deselect();
+    return response;
+}
+
+// Checks if SD card can operate at current device voltage; required for v2+
+// Implement error checking to make sure the check pattern and voltage is enough
+uint8_t SD_SendCMD8() {
+
+	SPI_Transfer(0xFF);
+
+	SD_Select();
+
+	SPI_Transfer(0x48);																	// CMD8
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x01);																	// Voltage level 2.7-3.6V
+	SPI_Transfer(0xAA);																	// Check pattern
+	SPI_Transfer(0x87);																	// CRC
+
+	uint8_t response[5];																// R7 Format - Returns voltage info and check pattern
+
+	for (int i = 0; i < 5; i++) {
+		response[i] = SPI_Transfer(0xFF);
+	}
+
+	SD_Deselect();																		// Deselects SD card and runs a cycle
+	SPI_Transfer(0xFF);
+
+	CON_DEBUG("CMD8: %d\r\n",response[1]);
+	return response[1];																	// Should be 0x01 if successful
+}
+
+// Returns a 5 byte response containing voltage and capacity information
+uint8_t SD_SendCMD58() {
+
+	SPI_Transfer(0xFF);
+
+	SD_Select();
+
+	SPI_Transfer(0x7A);    																// CMD58
+	SPI_Transfer(0x00);    																// Reserved
+	SPI_Transfer(0x00);    																// Reserved
+	SPI_Transfer(0x00);    																// Reserved
+	SPI_Transfer(0x00);    																// Reserved
+	SPI_Transfer(0xFF);    																// No CRC required
+
+	uint8_t response[5];
+
+	for (int i = 0; i < 5; i++) {
+		response[i] = SPI_Transfer(0xFF);
+	}
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	return response[0];																	// Should be 0x01
+}
+
+// Tells card that next command is application specific
+// Implement error checking
+uint8_t SD_SendCMD55() {
+
+	SPI_Transfer(0xFF);
+
+	SD_Select();
+
+	SPI_Transfer(0x77);																	// CMD55
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0xFF);																	// No CRC required
+
+	uint8_t response;
+
+	for (int i = 0; i < 10; i++) {
+		response = SPI_Transfer(0xFF);
+		if (response != 0xFF) break;
+		for (volatile int j = 0; j < 10000; j++);
+	}
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	CON_TRACE("CMD55: %d\r\n",response);
+	return response;																	// Should be 0x01
+}
+
+// Activates SD card initialization process; must follow CMD55 for each attempt
+uint8_t SD_SendACMD41() {
+
+	SPI_Transfer(0xFF);
+
+	SD_Select();
+
+	SPI_Transfer(0x69);																	// ACMD41
+	SPI_Transfer(0x40);																	// HCS bit
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0x00);																	// Reserved
+	SPI_Transfer(0xFF);																	// No CRC required
+
+	uint8_t response;
+
+	for (int i = 0; i < 50; i++) {
+		response = SPI_Transfer(0xFF);
+		if (response != 0xFF) break;
+		for (volatile int j = 0; j < 100000; j++);
+	}
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	CON_TRACE("ACMD41: %d\r\n",response);
+	return response;
+}
+
+// Initializes the SD card and keeps sending the commands until initialization completes
+uint8_t SD_Card_Init() {
+	uint8_t response;
+
+	do {
+		response = SD_SendCMD55();
+		if (response != 0x01) return response;
+
+		response = SD_SendACMD41();
+	} while (response == 0x01);
+
+	return response;
+}
+
+// Full SD card setup
+uint8_t SD_Init() {
+	uint8_t response;
+
+	SD_SetTimeouts(SPI_SetClock(SD_INIT_CLOCK));										// Back to identification speed, also on a re-init
+	sdBusy = 0;																			// CMD0 resets a card left busy, so the init commands never wait
+	SD_PowerUp();
+
+	response = SD_SendCMD0();
+	if(response != 0x01) return response;
+
+	response = SD_SendCMD8();
+	if (response != 0x01) return response;
+
+	response = SD_Card_Init();
+	if (response != 0x00) return response;
+
+	SD_SetMaxSpeed();
+
+	return 0;
+}
+
+// CRC16-CCITT used by the card on every data block, polynomial 0x1021
+static const uint16_t crc16Table[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+RAMFUNC uint16_t SD_CRC16(const uint8_t* data, uint16_t length) {
+	uint16_t crc = 0;
+
+	for (uint16_t i = 0; i < length; i++) {
+		crc = (crc << 8) ^ crc16Table[((crc >> 8) ^ data[i]) & 0xFF];
+	}
+
+	return crc;
+}
+
+// Reads the 16 byte CSD register with CMD9; the register arrives as a data block
+uint8_t SD_ReadCSD(uint8_t* csd) {
+	uint8_t response;
+	uint16_t timeout;
+
+	SPI_Transfer(0xFF);
+
+	if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+	SPI_Transfer(0x49);																	// CMD9
+	SPI_Transfer(0x00);
+	SPI_Transfer(0x00);
+	SPI_Transfer(0x00);
+	SPI_Transfer(0x00);
+	SPI_Transfer(0xFF);																	// No CRC required
+
+	timeout = 100;
+	do {
+		response = SPI_Transfer(0xFF);
+		timeout--;
+	} while (response == 0xFF && timeout > 0);
+
+	if (response != 0x00) {
+		SD_Deselect();
+		return 1;
+	}
+
+	timeout = sdTokenTimeout;
+	do {
+		response = SPI_Transfer(0xFF);
+		timeout--;
+	} while (response == 0xFF && timeout > 0);
+
+	if (response != 0xFE) {
+		SD_Deselect();
+		return 2;
+	}
+
+	for (int i = 0; i < 16; i++) {
+		csd[i] = SPI_Transfer(0xFF);
+	}
+
+	uint16_t crc = SPI_Transfer(0xFF) << 8;
+	crc |= SPI_Transfer(0xFF);
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	return (crc == SD_CRC16(csd, 16)) ? 0 : 4;
+}
+
+// Card capacity in 512 byte sectors; CSD 2.0 counts C_SIZE + 1 units of 512 KB, CSD 1.0 needs the multipliers
+// 64-bit because a full 22-bit C_SIZE (2 TB) is 2^32 sectors
+uint64_t SD_CSDSectors(const uint8_t* csd) {
+	if ((csd[0] >> 6) == 1) {
+		uint32_t cSize = ((uint32_t)(csd[7] & 0x3F) << 16) | ((uint32_t)csd[8] << 8) | csd[9];
+		return ((uint64_t)cSize + 1) << 10;
+	}
+
+	uint32_t cSize = ((uint32_t)(csd[6] & 0x03) << 10) | ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+	uint8_t mult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+	uint8_t readBlLen = csd[5] & 0x0F;
+	return ((cSize + 1) << (mult + 2)) << readBlLen >> 9;
+}
+
+// Reads the 64 byte SD_STATUS with ACMD13; R2 response, then a data block like CMD9
+uint8_t SD_ReadStatus(uint8_t* status) {
+	uint8_t response;
+	uint32_t timeout;
+
+	if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+	if (SD_SendCommand(55, 0) > 0x01 || SD_SendCommand(13, 0) != 0x00) {
+		SD_Deselect();
+		return 1;
+	}
+	SPI_Transfer(0xFF);																	// Second R2 byte
+
+	timeout = sdTokenTimeout;
+	do {
+		response = SPI_Transfer(0xFF);
+		timeout--;
+	} while (response == 0xFF && timeout > 0);
+
+	if (response != 0xFE) {
+		SD_Deselect();
+		return 2;
+	}
+
+	for (int i = 0; i < 64; i++) {
+		status[i] = SPI_Transfer(0xFF);
+	}
+
+	uint16_t crc = SPI_Transfer(0xFF) << 8;
+	crc |= SPI_Transfer(0xFF);
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	return (crc == SD_CRC16(status, 64)) ? 0 : 4;
+}
+
+// Allocation unit from SD_STATUS AU_SIZE (bits 431:428) in 512 byte sectors; 0 when the card leaves it undefined
+uint32_t SD_AUSectors(const uint8_t* status) {
+	return statusAUSectors[status[10] >> 4];
+}
+
+// Maximum data transfer rate in Hz from the CSD TRAN_SPEED byte; 0x32 is 25 MHz, 0x5A is 50 MHz
+uint32_t SD_MaxClock(const uint8_t* csd) {
+	uint8_t tranSpeed = csd[3];
+
+	if ((tranSpeed & 0x07) > 3) return 25000000;										// Reserved unit; default speed limit
+
+	return csdRateUnit[tranSpeed & 0x07] * csdTimeValue[(tranSpeed >> 3) & 0x0F];
+}
+
+// Picks the fastest SPI clock the card and SPI1 both allow
+void SD_SetMaxSpeed() {
+	uint8_t csd[16];
+	uint32_t maxClock = 25000000;
+
+	if (SD_ReadCSD(csd) == 0) {
+		maxClock = SD_MaxClock(csd);
+	} else {
+		CON_ERROR("CSD read failed, assuming 25 MHz\r\n");
+	}
+
+	uint32_t spiClock = SPI_SetClock(maxClock);
+	SD_SetTimeouts(spiClock);
+	CON_INFO("SPI clock %lu Hz (card max %lu Hz)\r\n", (unsigned long)spiClock, (unsigned long)maxClock);
+}
+
+// Drops one prescaler step after CRC errors or token timeouts; returns 0 once already at /256
+uint8_t SD_SpeedDown() {
+	uint32_t spiClock = SPI_SlowDown();
+	if (spiClock == 0) return 0;
+
+	SD_SetTimeouts(spiClock);
+	CON_INFO("SPI clock lowered to %lu Hz\r\n", (unsigned long)spiClock);
+	return 1;
+}
+
+// Gets a block to read; Sends CMD17 to the SD card with the MSB -> LSB in bytes
+RAMFUNC uint8_t SD_ReadBlock(uint32_t blockAddress, uint8_t* buffer) {
+    uint8_t response;
+    uint32_t timeout;
+
+    if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+    SPI_Transfer(0x51);
+    SPI_Transfer((blockAddress >> 24) & 0xFF);
+    SPI_Transfer((blockAddress >> 16) & 0xFF);
+    SPI_Transfer((blockAddress >> 8) & 0xFF);
+    SPI_Transfer(blockAddress & 0xFF);
+    SPI_Transfer(0xFF);
+
+    timeout = 100;
+    do {
+        response = SPI_Transfer(0xFF);
+        timeout--;
+    } while (response == 0xFF && timeout > 0);
+
+    if (response != 0x00) {
+        CON_ERROR("Read cmd response error: %02X\r\n", response);
+        SD_Deselect();
+        return 1;
+    }
+
+    timeout = sdTokenTimeout;
+    do {
+        response = SPI_Transfer(0xFF);
+        timeout--;
+    } while (response == 0xFF && timeout > 0);
+
+    if (response != 0xFE) {
+        CON_ERROR("No data token: %02X\r\n", response);
+        SD_Deselect();
+        return 2;
+    }
+
+    SPI_DMA_Start(NULL, buffer, 512);													// Payload streams straight into the caller's buffer
+    if (SPI_DMA_Wait() != 0) {
+        CON_ERROR("Read DMA error\r\n");
+        SD_Deselect();
+        return 3;
+    }
+
+    uint16_t crc = SPI_Transfer(0xFF) << 8;
+    crc |= SPI_Transfer(0xFF);
+
+    SPI_Transfer(0xFF);
+
+    SD_Deselect();
+
+    if (crc != SD_CRC16(buffer, 512)) {
+        CON_ERROR("Read CRC error\r\n");
+        return 4;
+    }
+
+    return 0;
+}
+
+// Streams count consecutive blocks with CMD18 and ends the stream with CMD12
+uint8_t SD_ReadMultiBlock(uint32_t blockAddress, uint8_t* buffer, uint32_t count) {
+    uint8_t response;
+    uint32_t timeout;
+    uint8_t result = 0;
+
+    if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+    SPI_Transfer(0x52);
+    SPI_Transfer((blockAddress >> 24) & 0xFF);
+    SPI_Transfer((blockAddress >> 16) & 0xFF);
+    SPI_Transfer((blockAddress >> 8) & 0xFF);
+    SPI_Transfer(blockAddress & 0xFF);
+    SPI_Transfer(0xFF);
+
+    timeout = 100;
+    do {
+        response = SPI_Transfer(0xFF);
+        timeout--;
+    } while (response == 0xFF && timeout > 0);
+
+    if (response != 0x00) {
+        CON_ERROR("Multi read cmd response error: %02X\r\n", response);
+        SD_Deselect();
+        return 1;
+    }
+
+    while (count > 0) {
+        timeout = sdTokenTimeout;
+        do {
+            response = SPI_Transfer(0xFF);
+            timeout--;
+        } while (response == 0xFF && timeout > 0);
+
+        if (response != 0xFE) {
+            CON_ERROR("No data token: %02X\r\n", response);
+            result = 2;
+            break;
+        }
+
+        SPI_DMA_Start(NULL, buffer, 512);
+        if (SPI_DMA_Wait() != 0) {
+            CON_ERROR("Read DMA error\r\n");
+            result = 3;
+            break;
+        }
+
+        uint16_t crc = SPI_Transfer(0xFF) << 8;
+        crc |= SPI_Transfer(0xFF);
+
+        if (crc != SD_CRC16(buffer, 512)) {
+            CON_ERROR("Read CRC error\r\n");
+            result = 4;
+            break;
+        }
+
+        buffer += 512;
+        count--;
+    }
+
+    if (SD_StopTransmission() != 0x00 && result == 0) {
+        result = 1;
+    }
+
+    SD_Deselect();
+    SPI_Transfer(0xFF);
+
+    return result;
+}
+
+// CMD12 while selected; the card may still be clocking out data, so the byte after the command is discarded
+uint8_t SD_StopTransmission() {
+    uint8_t response;
+    uint16_t timeout;
+
+    SPI_Transfer(0x4C);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0x00);
+    SPI_Transfer(0xFF);
+
+    SPI_Transfer(0xFF);                                                             // Stuff byte
+
+    timeout = 100;
+    do {
+        response = SPI_Transfer(0xFF);
+        timeout--;
+    } while (response == 0xFF && timeout > 0);
+
+    timeout = 10000;
+    while (SPI_Transfer(0xFF) != 0xFF && timeout > 0) {                             // R1b; busy until MISO is released
+        timeout--;
+    }
+
+    return response;
+}
+
+// Gets a block to write to; Sends CMD24 to the SD card with the MSB -> LSB in bytes
+RAMFUNC uint8_t SD_WriteBlock(uint32_t blockAddress, const uint8_t* buffer) {
+	uint8_t response;
+	uint16_t retry = 0;
+
+	if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+	SPI_Transfer(0x58);
+	SPI_Transfer((blockAddress >> 24) & 0xFF);
+	SPI_Transfer((blockAddress >> 16) & 0xFF);
+	SPI_Transfer((blockAddress >> 8) & 0xFF);
+	SPI_Transfer(blockAddress & 0xFF);
+
+	SPI_Transfer(0xFF);
+
+	do {
+		response = SPI_Transfer(0xFF);
+		retry++;
+	} while (response == 0xFF && retry < 1000);
+
+	if (response != 0x00) {
+		SD_Deselect();
+		return response;
+	}
+
+	SPI_Transfer(0xFE);
+
+	SPI_DMA_Start(buffer, NULL, 512);													// Payload leaves back to back from the caller's buffer
+	if (SPI_DMA_Wait() != 0) {
+		SD_Deselect();
+		return 0xFF;
+	}
+
+	SPI_Transfer(0xFF);
+	SPI_Transfer(0xFF);
+
+	response = SPI_Transfer(0xFF);
+	if ((response & 0x1F) != 0x05) {
+		SD_Deselect();
+		return response;
+	}
+
+	sdBusy = 1;																			// Programming continues with CS high; SD_Select waits it out
+	SD_Deselect();
+
+	return 0x00;
+}
+
+// Sends a command to an already selected card and returns R1; not for CMD0/CMD8, which need a real CRC
+uint8_t SD_SendCommand(uint8_t cmd, uint32_t arg) {
+	uint8_t response;
+	uint16_t timeout = 100;
+
+	SPI_Transfer(0x40 | cmd);
+	SPI_Transfer((arg >> 24) & 0xFF);
+	SPI_Transfer((arg >> 16) & 0xFF);
+	SPI_Transfer((arg >> 8) & 0xFF);
+	SPI_Transfer(arg & 0xFF);
+	SPI_Transfer(0xFF);																	// No CRC required
+
+	do {
+		response = SPI_Transfer(0xFF);
+		timeout--;
+	} while ((response & 0x80) && timeout > 0);
+
+	return response;
+}
+
+// Waits up to 500 ms for the card to release MISO after programming; returns 0xFF when ready
+RAMFUNC uint8_t SD_WaitReady() {
+	uint8_t response;
+	uint32_t timeout = sdBusyTimeout;
+
+	PROF_BEGIN(t);
+	do {
+		response = SPI_Transfer(0xFF);
+		timeout--;
+	} while (response != 0xFF && timeout > 0);
+	PROF_END(PROF_SD_BUSY, t);
+
+	return response;
+}
+
+// Streams count blocks with CMD25 after an ACMD23 pre-erase hint; written receives the blocks the card accepted
+uint8_t SD_WriteMultiBlock(uint32_t blockAddress, const uint8_t* buffer, uint32_t count, uint32_t* written) {
+	uint8_t response;
+	uint8_t result = 0;
+
+	*written = 0;
+
+	if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+	if (SD_SendCommand(55, 0) <= 0x01) {
+		SD_SendCommand(23, count & 0x7FFFFF);											// ACMD23; only a hint, a failure is not fatal
+	}
+
+	response = SD_SendCommand(25, blockAddress);
+	if (response != 0x00) {
+		SD_Deselect();
+		return response;
+	}
+
+	SPI_Transfer(0xFF);																	// At least one byte gap before the first token
+
+	for (uint32_t i = 0; i < count; i++) {
+		SPI_Transfer(0xFC);																// Multi block write token
+
+		SPI_DMA_Start(buffer, NULL, 512);
+		if (SPI_DMA_Wait() != 0) {
+			result = 0xFF;
+			break;
+		}
+
+		SPI_Transfer(0xFF);																// CRC, ignored in SPI mode
+		SPI_Transfer(0xFF);
+
+		response = SPI_Transfer(0xFF);
+		if ((response & 0x1F) != 0x05) {												// Data response; 0x0B CRC error, 0x0D write error
+			result = response;
+			break;
+		}
+
+		if (SD_WaitReady() != 0xFF) {
+			result = SD_BUSY_ERROR;
+			break;
+		}
+
+		buffer += 512;
+		(*written)++;
+	}
+
+	SPI_Transfer(0xFD);																	// Stop token
+	SPI_Transfer(0xFF);
+	sdBusy = 1;																			// Final programming overlaps whatever the caller does next
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	if (result != 0) {
+		SD_GetWrittenBlocks(written);													// The card's count is exact, ours only counts responses
+	}
+
+	return result;
+}
+
+// ACMD22 SEND_NUM_WR_BLOCKS; number of blocks of the last multi block write that were programmed
+uint8_t SD_GetWrittenBlocks(uint32_t* blocks) {
+	uint8_t response;
+	uint8_t data[4];
+	uint32_t timeout;
+
+	if (SD_Select() != 0) return SD_BUSY_ERROR;
+
+	if (SD_SendCommand(55, 0) > 0x01 || SD_SendCommand(22, 0) != 0x00) {
+		SD_Deselect();
+		return 1;
+	}
+
+	timeout = sdTokenTimeout;
+	do {
+		response = SPI_Transfer(0xFF);
+		timeout--;
+	} while (response == 0xFF && timeout > 0);
+
+	if (response != 0xFE) {
+		SD_Deselect();
+		return 2;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		data[i] = SPI_Transfer(0xFF);
+	}
+
+	uint16_t crc = SPI_Transfer(0xFF) << 8;
+	crc |= SPI_Transfer(0xFF);
+
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+
+	if (crc != SD_CRC16(data, 4)) return 4;
+
+	*blocks = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+	return 0;
+}
+
+// Polls DO once without waiting; 0 once the card has finished programming
+uint8_t SD_IsBusy() {
+	if (!sdBusy) return 0;
+
+	SPI_Select();																		// Not SD_Select, which would block
+	if (SPI_Transfer(0xFF) == 0xFF) {
+		sdBusy = 0;
+	}
+	SD_Deselect();
+
+	return sdBusy;
+}
+
+// Blocks until a deferred write has been programmed; SD_BUSY_ERROR if the card is still busy after 500 ms
+uint8_t SD_Sync() {
+	if (!sdBusy) return 0;
+
+	if (SD_Select() != 0) return SD_BUSY_ERROR;
+	SD_Deselect();
+	SPI_Transfer(0xFF);
+	return 0;
+}
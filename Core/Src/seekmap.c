@@ -0,0 +1,59 @@
+// Cluster link map per open file so f_lseek costs O(fragments) in RAM instead of one get_fat per cluster
+// The map is only installed in the FIL for the duration of a seek, so reads and writes on the file
+// follow and grow the chain exactly as without it.
+#include <string.h>
+#include "seekmap.h"
+
+// Builds the map, or extends it from its last fragment when the file has grown since
+static FRESULT SeekMap_Update(Seek_Map* map) {
+	FRESULT fr;
+
+	map -> table[0] = SEEKMAP_ITEMS;
+	map -> fp -> cltbl = map -> table;
+	fr = f_lseek(map -> fp, map -> valid ? EXTEND_LINKMAP : CREATE_LINKMAP);
+	map -> fp -> cltbl = 0;
+
+	if (fr == FR_NOT_ENOUGH_CORE) {
+		map -> valid = 0;
+		map -> overflow = 1;
+		return FR_OK;
+	}
+	if (fr != FR_OK) {
+		map -> valid = 0;
+		return fr;
+	}
+
+	map -> valid = 1;
+	map -> mapped = f_size(map -> fp);
+	return FR_OK;
+}
+
+FRESULT SeekMap_Attach(Seek_Map* map, FIL* fp) {
+	memset(map, 0, sizeof(*map));
+	map -> fp = fp;
+
+	return SeekMap_Update(map);
+}
+
+// f_lseek replacement; beyond the end of a writable file it falls back to f_lseek, which stretches the chain
+FRESULT SeekMap_Seek(Seek_Map* map, FSIZE_t ofs) {
+	FRESULT fr;
+	FIL* fp = map -> fp;
+
+	if (map -> overflow || ofs > f_size(fp)) return f_lseek(fp, ofs);
+
+	if (!map -> valid || f_size(fp) > map -> mapped) {
+		fr = SeekMap_Update(map);
+		if (fr != FR_OK) return fr;
+		if (!map -> valid) return f_lseek(fp, ofs);
+	}
+
+	fp -> cltbl = map -> table;
+	fr = f_lseek(fp, ofs);
+	fp -> cltbl = 0;
+	return fr;
+}
+
+uint32_t SeekMap_Fragments(const Seek_Map* map) {
+	return map -> valid ? (map -> table[0] - 2) / 2 : 0;
+}
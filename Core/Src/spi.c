@@ -0,0 +1,142 @@
+// SPI1 and the PB6 chip select; the only hardware the SD card driver touches
+#include "main.h"
+#include "clock.h"
+#include "spi.h"
+
+static uint8_t spiPrescaler = 7;															// Current SPI1 BR bits
+static uint8_t dmaFill = 0xFF;																// Clocked out while receiving; read with no address increment
+static uint8_t dmaSink;																		// Discards received bytes while transmitting
+
+void SPI_Init() {
+	RCC -> AHB1ENR |= (1 << 0);															// GPOPA Clock
+	RCC -> AHB1ENR |= (1 << 1);															// GPOPB Clock
+	RCC -> APB2ENR |= (1 << 12);														// SPI1 Clock
+
+	GPIOB -> MODER &= ~(3 << (2 * 6));													// PB6 for output/SD card and generates a high signal; bit amount * pin number
+	GPIOB -> MODER |= (1 << (2 * 6));
+	GPIOB -> ODR |= (1 << 6);
+
+	GPIOA -> MODER &= ~((3 << (2 * 5)) | (3 << (2 * 6)) | (3 << (2 * 7))); 				// PA5, PA6 & PA7 set for Alternate Function
+	GPIOA -> MODER |= ((2 << (2 * 5)) | (2 << (2 * 6)) | (2 << (2 * 7)));
+
+	GPIOA->PUPDR &= ~(3 << (2 * 6));  													// Set pull-up
+	GPIOA->PUPDR |= (1 << (2 * 6));
+
+	GPIOA -> AFR[0] &= ~((15 << (4 * 5)) | (15 << (4 * 6)) | (15 << (4 * 7)));			// PA5, PA6 & PA7 set for AFR5; SPI1
+	GPIOA -> AFR[0] |= (5 << (4 * 5)) | (5 << (4 * 6)) | (5 << (4 * 7));
+
+	SPI1 -> CR1 = 0;																	// Resets SPI1
+	SPI1 -> CR1 |= (1 << 2);															// Sets Master mode
+	SPI1 -> CR1 |= (7 << 3);															// /256 until SD_Init picks the identification clock
+	SPI1 -> CR1 |= (1 << 8);															// Used to select any pin for NSS instead of hardware
+	SPI1 -> CR1 |= (1 << 9);															// Enables SSM
+	SPI1 -> CR1 |= (1 << 6);															// SPI1 Enable
+}
+
+// Reprograms the SPI1 BR bits; fPCLK2 / 2^(br + 1)
+static void SPI_SetPrescaler(uint8_t br) {
+	while (SPI1 -> SR & (1 << 7));														// Never change the baud rate mid frame
+
+	SPI1 -> CR1 &= ~(1 << 6);															// SPI1 Disable
+	SPI1 -> CR1 &= ~(7 << 3);
+	SPI1 -> CR1 |= ((br & 7) << 3);
+	SPI1 -> CR1 |= (1 << 6);															// SPI1 Enable
+
+	spiPrescaler = br & 7;
+}
+
+// Fastest SCK not above maxHz that SPI1 can make (fPCLK2 / 2 at most); returns the resulting rate
+uint32_t SPI_SetClock(uint32_t maxHz) {
+	uint32_t pclk = Clock_GetPCLK2();
+
+	SPI_SetPrescaler(Clock_SPIPrescaler(pclk, maxHz));
+	return pclk >> (spiPrescaler + 1);
+}
+
+// One prescaler step slower; returns the new rate, or 0 when already at /256
+uint32_t SPI_SlowDown() {
+	if (spiPrescaler >= 7) return 0;
+
+	SPI_SetPrescaler(spiPrescaler + 1);
+	return SPI_GetClock();
+}
+
+uint32_t SPI_GetClock() {
+	return Clock_GetPCLK2() >> (spiPrescaler + 1);
+}
+
+void SPI_Select() {
+	GPIOB -> ODR &= ~(1 << 6);															// Generates a low output
+}
+
+void SPI_Deselect() {
+	GPIOB -> ODR |= (1 << 6);															// Generates a high output
+}
+
+// Actual SPI Data Transfer; runs from SRAM since every command byte and busy poll goes through here
+RAMFUNC uint8_t SPI_Transfer(uint8_t data) {
+    while(!(SPI1->SR & (1 << 1)));    													// Waits for TXE bit
+    SPI1->DR = data;                  													// Sends data from register
+    while(!(SPI1->SR & (1 << 0)));   													// Wait for RXNE bit
+    return SPI1->DR;                  													// Returns the received byte
+}
+
+// DMA2 Stream0 Channel 3 is SPI1_RX, DMA2 Stream3 Channel 3 is SPI1_TX
+void SPI_DMA_Init() {
+	RCC -> AHB1ENR |= (1 << 22);														// DMA2 Clock
+
+	DMA2_Stream0 -> CR = 0;																// Streams must be disabled before configuration
+	DMA2_Stream3 -> CR = 0;
+	while ((DMA2_Stream0 -> CR & (1 << 0)) || (DMA2_Stream3 -> CR & (1 << 0)));
+
+	DMA2_Stream0 -> PAR = (uint32_t)&SPI1 -> DR;										// Both streams work against the SPI1 data register
+	DMA2_Stream3 -> PAR = (uint32_t)&SPI1 -> DR;
+
+	DMA2_Stream0 -> FCR = 0;															// Direct mode, FIFO unused for byte transfers
+	DMA2_Stream3 -> FCR = 0;
+}
+
+// Starts a full duplex transfer of len bytes; tx == NULL clocks out 0xFF, rx == NULL discards received data
+void SPI_DMA_Start(const uint8_t* tx, uint8_t* rx, uint16_t len) {
+	DMA2 -> LIFCR = (0x3D << 0) | (0x3D << 22);											// Clears every Stream0 & Stream3 flag
+
+	DMA2_Stream0 -> CR = (3 << 25);														// Channel 3, peripheral to memory, byte size
+	DMA2_Stream0 -> CR |= (3 << 16);													// Very high priority so RX always drains before the next TX byte
+	DMA2_Stream0 -> M0AR = (uint32_t)(rx ? rx : &dmaSink);
+	DMA2_Stream0 -> NDTR = len;
+	if (rx) DMA2_Stream0 -> CR |= (1 << 10);											// Memory increment only into a real buffer
+
+	DMA2_Stream3 -> CR = (3 << 25);														// Channel 3, byte size
+	DMA2_Stream3 -> CR |= (1 << 6);														// Memory to peripheral
+	DMA2_Stream3 -> CR |= (2 << 16);													// High priority
+	DMA2_Stream3 -> M0AR = (uint32_t)(tx ? tx : &dmaFill);
+	DMA2_Stream3 -> NDTR = len;
+	if (tx) DMA2_Stream3 -> CR |= (1 << 10);											// Constant 0xFF for reads
+
+	DMA2_Stream0 -> CR |= (1 << 0);														// RX first so no byte is missed
+	DMA2_Stream3 -> CR |= (1 << 0);
+
+	SPI1 -> CR2 |= (1 << 0) | (1 << 1);													// RXDMAEN & TXDMAEN; TXE immediately requests the first byte
+}
+
+// Blocks until the last byte has been received; returns 1 on a DMA transfer error
+uint8_t SPI_DMA_Wait() {
+	uint8_t error = 0;
+
+	while (!(DMA2 -> LISR & (1 << 5))) {												// Waits for Stream0 TCIF
+		if (DMA2 -> LISR & ((1 << 3) | (1 << 25))) {									// TEIF0 or TEIF3
+			error = 1;
+			break;
+		}
+	}
+
+	while (SPI1 -> SR & (1 << 7));														// Waits for BSY to clear
+
+	SPI1 -> CR2 &= ~((1 << 0) | (1 << 1));
+	DMA2_Stream0 -> CR &= ~(1 << 0);
+	DMA2_Stream3 -> CR &= ~(1 << 0);
+	while ((DMA2_Stream0 -> CR & (1 << 0)) || (DMA2_Stream3 -> CR & (1 << 0)));
+
+	DMA2 -> LIFCR = (0x3D << 0) | (0x3D << 22);
+	return error;
+}
@@ -0,0 +1,68 @@
+// Internal flash spill area; RM0390 section 3.6 (flash program/erase operations)
+// Sector 7, the last 128 KB of the F446RE, is cut out of the FLASH region by the linker script.
+// While the flash programs or erases, every fetch from it stalls, so both routines run from SRAM.
+// An interrupt whose vector or handler is in flash still waits: up to ~16 us per word, 1-2 s per erase.
+#include "main.h"
+#include "clock.h"
+#include "spill.h"
+
+#define SPILL_SECTOR		7
+#define SPILL_ERRORS		((1 << 1) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 7) | (1 << 8))	// OPERR, WRPERR, PGAERR, PGPERR, PGSERR & RDERR
+
+extern uint8_t __spill_start[];																// STM32F446RETX_FLASH.ld
+
+// The ART data cache may hold lines of the area from before the operation; RM0390 3.5.2
+static inline void Spill_FlushCache() {
+	FLASH -> ACR &= ~(1 << 10);																// DCEN off; DCRST only works with the cache disabled
+	FLASH -> ACR |= (1 << 12);
+	FLASH -> ACR &= ~(1 << 12);
+	FLASH -> ACR |= (1 << 10);
+}
+
+static inline void Spill_Unlock() {
+	if (FLASH -> CR & (1U << 31)) {
+		FLASH -> KEYR = 0x45670123;
+		FLASH -> KEYR = 0xCDEF89AB;
+	}
+	while (FLASH -> SR & (1 << 16));														// BSY
+	FLASH -> SR = SPILL_ERRORS | (1 << 0);													// Clears stale error flags and EOP
+}
+
+const uint8_t* Spill_Data() {
+	return __spill_start;
+}
+
+// Returns 1 on a program/erase error; the area is unusable until an erase succeeds
+RAMFUNC uint8_t Spill_Erase() {
+	Spill_Unlock();
+	FLASH -> CR = (2 << 8) | (SPILL_SECTOR << 3) | (1 << 1);								// PSIZE x32, SNB, SER
+	FLASH -> CR |= (1 << 16);																// STRT
+	while (FLASH -> SR & (1 << 16));
+
+	uint8_t error = (FLASH -> SR & SPILL_ERRORS) != 0;
+	FLASH -> CR = (1U << 31);																// LOCK
+	Spill_FlushCache();
+	return error;
+}
+
+// Programs length bytes (a multiple of 4) at a word aligned offset; data may be unaligned
+RAMFUNC uint8_t Spill_Program(uint32_t offset, const uint8_t* data, uint32_t length) {
+	volatile uint32_t* dest = (volatile uint32_t*)(__spill_start + offset);
+	uint8_t error = 0;
+
+	Spill_Unlock();
+	FLASH -> CR = (2 << 8) | (1 << 0);														// PSIZE x32, PG
+	for (uint32_t i = 0; i < length; i += 4, data += 4) {
+		*dest++ = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		__DSB();
+		while (FLASH -> SR & (1 << 16));
+		if (FLASH -> SR & SPILL_ERRORS) {
+			error = 1;
+			break;
+		}
+	}
+
+	FLASH -> CR = (1U << 31);
+	Spill_FlushCache();
+	return error;
+}
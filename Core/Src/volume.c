@@ -0,0 +1,52 @@
+// On-device formatting laid out for the card: the partition, FAT and data area start on allocation unit
+// boundaries (ACMD13 AU_SIZE through GET_BLOCK_SIZE), so no cluster straddles two AUs; the card's
+// speed class is specified for writes that fill whole AUs from their start.
+#include "volume.h"
+#include "diskio.h"
+
+// The largest cluster up to the ceiling for the card's size and the AU. A larger cluster means fewer
+// FAT or bitmap sectors dirtied and fewer allocation steps per megabyte written. Cards above 32 GB
+// (SDXC) get exFAT; below that f_mkfs picks FAT16 for 2 GB and less and FAT32 above, as the SD file
+// system specification does. If f_mkfs still refuses, the size halves until it fits.
+FRESULT Vol_Format(const TCHAR* path, void* work, UINT len) {
+	MKFS_PARM opt = { FM_FAT | FM_FAT32, 1, 0, 0, 0 };										// One FAT; the mirror would double FAT writes
+	LBA_t sectors = 0;
+	DWORD block = 1;
+	FRESULT fr;
+
+	if ((disk_status(0) & STA_NOINIT) && (disk_initialize(0) & STA_NOINIT)) return FR_NOT_READY;
+	if (disk_ioctl(0, GET_BLOCK_SIZE, &block) != RES_OK) block = 1;
+	if (disk_ioctl(0, GET_SECTOR_COUNT, &sectors) != RES_OK) return FR_DISK_ERR;
+
+	opt.au_size = VOL_CLUSTER_MAX;
+#if FF_FS_EXFAT
+	if (sectors > VOL_EXFAT_SECTORS) {
+		opt.fmt = FM_EXFAT;
+		opt.au_size = VOL_EXFAT_CLUSTER_MAX;
+	}
+#endif
+	if (block > 1 && block * FF_MAX_SS < opt.au_size) opt.au_size = block * FF_MAX_SS;
+
+	for (;;) {
+		fr = f_mkfs(path, &opt, work, len);
+		if (fr != FR_MKFS_ABORTED || opt.au_size <= FF_MAX_SS) break;
+		opt.au_size /= 2;
+	}
+
+	return fr;
+}
+
+// Where a mounted volume actually sits, for the boot report and the reformat decision
+FRESULT Vol_GetLayout(FATFS* fs, Vol_Layout* layout) {
+	layout -> block = 1;
+	if (disk_ioctl(fs -> pdrv, GET_SECTOR_COUNT, &layout -> sectors) != RES_OK) return FR_DISK_ERR;
+	if (disk_ioctl(fs -> pdrv, GET_BLOCK_SIZE, &layout -> block) != RES_OK || layout -> block == 0) layout -> block = 1;
+
+	layout -> cluster = (DWORD)fs -> csize * FF_MAX_SS;
+	layout -> base = fs -> volbase;
+	layout -> fat = fs -> fatbase;
+	layout -> data = fs -> database;
+	layout -> aligned = (layout -> base % layout -> block == 0) && (layout -> data % layout -> block == 0);
+
+	return FR_OK;
+}
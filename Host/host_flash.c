@@ -0,0 +1,32 @@
+// spill.h on the host: a RAM array with flash rules, its program and erase times charged to the emulator clock
+#include <string.h>
+#include "spill.h"
+#include "sd_emu.h"
+
+#define HOST_FLASH_WORD_NS	16000ULL														// Typical x32 word program time
+#define HOST_FLASH_ERASE_NS	1000000000ULL													// Typical 128 KB sector erase at x32
+
+static uint32_t words[SPILL_SIZE / 4];														// Zeros until the first erase, like a used sector
+static uint8_t* const area = (uint8_t*)words;
+
+const uint8_t* Spill_Data() {
+	return area;
+}
+
+uint8_t Spill_Erase() {
+	memset(area, 0xFF, SPILL_SIZE);
+	SdEmu_Advance(HOST_FLASH_ERASE_NS);
+	return 0;
+}
+
+// A word can only clear bits; anything else is the PGSERR the board would raise
+uint8_t Spill_Program(uint32_t offset, const uint8_t* data, uint32_t length) {
+	if ((offset | length) & 3 || offset + length > SPILL_SIZE) return 1;
+
+	for (uint32_t i = 0; i < length; i++) {
+		if ((area[offset + i] & data[i]) != data[i]) return 1;
+		area[offset + i] = data[i];
+		if ((i & 3) == 3) SdEmu_Advance(HOST_FLASH_WORD_NS);
+	}
+	return 0;
+}
@@ -0,0 +1,912 @@
+// Host regression and throughput run for sd_spi.c, diskio.c and FatFs on an emulated card
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ff.h"
+#include "diskio.h"
+#include "logger.h"
+#include "seekmap.h"
+#include "recfmt.h"
+#include "lz.h"
+#include "logread.h"
+#include "fmt.h"
+#include <time.h>
+#include "spi.h"
+#include "profile.h"
+#include "sd_emu.h"
+#include "volume.h"
+#include "spill.h"
+#include "sd_spi.h"
+
+static BYTE work[FF_MAX_SS];
+static uint8_t pattern[2 * VOL_EXFAT_CLUSTER_MAX];											// A whole cluster and then some
+static uint8_t check[2 * VOL_EXFAT_CLUSTER_MAX];
+
+static void Host_Fill(uint8_t* data, UINT length, uint32_t seed) {
+	for (UINT i = 0; i < length; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+// Writes a file in chunk sized calls, reads it back and compares
+static int Host_RoundTrip(const char* path, UINT size, UINT chunk) {
+	FIL file;
+	FRESULT fr;
+	UINT bw, br;
+
+	Host_Fill(pattern, size, size ^ chunk);
+
+	fr = f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS);
+	if (fr != FR_OK) {
+		printf("FAIL open %s: %d\r\n", path, fr);
+		return 1;
+	}
+	for (UINT done = 0; done < size; done += bw) {
+		UINT n = (size - done < chunk) ? size - done : chunk;
+		fr = f_write(&file, pattern + done, n, &bw);
+		if (fr != FR_OK || bw != n) {
+			printf("FAIL write %s at %u: %d\r\n", path, done, fr);
+			f_close(&file);
+			return 1;
+		}
+	}
+	f_close(&file);
+
+	memset(check, 0, size);
+	fr = f_open(&file, path, FA_READ);
+	if (fr == FR_OK) fr = f_read(&file, check, size, &br);
+	f_close(&file);
+	if (fr != FR_OK || br != size || memcmp(pattern, check, size) != 0) {
+		printf("FAIL verify %s (%u bytes, %u per call): %d\r\n", path, size, chunk, fr);
+		return 1;
+	}
+
+	printf("ok %s %u bytes, %u per call\r\n", path, size, chunk);
+	return 0;
+}
+
+// Punches holes into a run of small files, then checks a large file reuses them and the free count adds up
+static int Host_Fragment(void) {
+	FATFS* fs;
+	DWORD before, after;
+	char name[32];
+	int failures = 0;
+
+	f_mkdir("FRAG");
+	for (int i = 0; i < 64; i++) {
+		sprintf(name, "FRAG/F%02d.BIN", i);
+		failures += Host_RoundTrip(name, 4096, 4096) ? 1 : 0;
+	}
+	for (int i = 0; i < 64; i += 2) {
+		sprintf(name, "FRAG/F%02d.BIN", i);
+		f_unlink(name);
+	}
+
+	if (f_getfree("", &before, &fs) != FR_OK) return 1;
+	failures += Host_RoundTrip("FRAG/BIG.BIN", 65536, 8192);
+	if (f_getfree("", &after, &fs) != FR_OK) return 1;
+
+	DWORD used = before - after;
+	DWORD expected = (65536 + fs -> csize * 512 - 1) / (fs -> csize * 512);
+	if (used != expected) {
+		printf("FAIL free count: %u clusters used, %u expected\r\n", used, expected);
+		failures++;
+	}
+	return failures;
+}
+
+// Sequential write then read of total bytes in chunk sized calls; rates in simulated bus time
+static void Host_Throughput(UINT total, UINT chunk) {
+	FIL file;
+	UINT bw, br;
+	uint64_t start;
+
+	Host_Fill(pattern, chunk, chunk);
+	if (f_open(&file, "SEQ.BIN", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return;
+	start = SdEmu_Now();
+	for (UINT done = 0; done < total; done += chunk) {
+		if (f_write(&file, pattern, chunk, &bw) != FR_OK) break;
+	}
+	f_close(&file);
+	uint64_t writeNs = SdEmu_Now() - start;
+
+	if (f_open(&file, "SEQ.BIN", FA_READ) != FR_OK) return;
+	start = SdEmu_Now();
+	for (UINT done = 0; done < total; done += chunk) {
+		if (f_read(&file, check, chunk, &br) != FR_OK) break;
+	}
+	f_close(&file);
+	uint64_t readNs = SdEmu_Now() - start;
+
+	printf("seq,%u,write_kBps,%llu,read_kBps,%llu\r\n", chunk,
+			(unsigned long long)((uint64_t)total * 1000 / (writeNs / 1000 + 1)),
+			(unsigned long long)((uint64_t)total * 1000 / (readNs / 1000 + 1)));
+}
+
+// Logger shaped load: small appends with an f_sync every syncEvery calls
+static void Host_Append(UINT total, UINT chunk, UINT syncEvery) {
+	FIL file;
+	UINT bw, calls = 0;
+	DCACHE_STATS cache;
+
+	Host_Fill(pattern, chunk, chunk);
+	if (f_open(&file, "LOGDIR/APPEND.LOG", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return;
+	disk_cache_reset_stats();
+	uint64_t start = SdEmu_Now();
+	for (UINT done = 0; done < total; done += chunk) {
+		if (f_write(&file, pattern, chunk, &bw) != FR_OK) break;
+		if (++calls % syncEvery == 0) f_sync(&file);
+	}
+	f_close(&file);
+	uint64_t ns = SdEmu_Now() - start;
+
+	disk_cache_stats(&cache);
+	printf("append,%u,sync_every,%u,us_per_call,%llu,cache_hits,%u,misses,%u,absorbed,%u,writebacks,%u,evictions,%u\r\n",
+			chunk, syncEvery, (unsigned long long)(ns / 1000 / calls),
+			cache.hits, cache.misses, cache.absorbed, cache.writebacks, cache.evictions);
+}
+
+// Appends a cluster to a and 128 to b per round so every cluster of a is a fragment on its own FAT sector
+static int Host_Interleave(FATFS* fs, FIL* a, FIL* b, int rounds) {
+	UINT bw;
+	UINT cluster = fs -> csize * 512;
+
+	for (int i = 0; i < rounds; i++) {
+		FSIZE_t at = f_size(a);
+		if (f_lseek(a, at) != FR_OK) return 1;
+		Host_Fill(pattern, cluster, (uint32_t)at);
+		if (f_write(a, pattern, cluster, &bw) != FR_OK || bw != cluster) return 1;
+		if (f_lseek(b, f_size(b) + (FSIZE_t)cluster * 128) != FR_OK) return 1;			// One FAT sector of b between a's clusters
+	}
+	return 0;
+}
+
+// Random 16 byte reads into a fragmented file with and without the link map; checks data and cost
+static int Host_Seek(FATFS* fs) {
+	FIL a, b;
+	Seek_Map map;
+	UINT br;
+	SdEmu_Stats s0, s1;
+	uint64_t reads[2], ns[2];
+	UINT cluster = fs -> csize * 512;
+	int failures = 0;
+
+	if (f_open(&a, "FRAG/A.BIN", FA_READ | FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return 1;
+	if (f_open(&b, "FRAG/B.BIN", FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) return 1;
+	if (Host_Interleave(fs, &a, &b, 20) != 0) return 1;
+
+	for (int mode = 0; mode < 2; mode++) {
+		if (mode && SeekMap_Attach(&map, &a) != FR_OK) return 1;
+
+		uint32_t seed = 7;
+		SdEmu_GetStats(&s0);
+		uint64_t start = SdEmu_Now();
+		for (int i = 0; i < 200; i++) {
+			seed = seed * 1103515245 + 12345;
+			FSIZE_t ofs = (seed >> 8) % (f_size(&a) - 16);
+			FRESULT fr = mode ? SeekMap_Seek(&map, ofs) : f_lseek(&a, ofs);
+			if (fr == FR_OK) fr = f_read(&a, check, 16, &br);
+			Host_Fill(pattern, ofs % cluster + 16, (uint32_t)(ofs - ofs % cluster));
+			if (fr != FR_OK || br != 16 || memcmp(check, pattern + ofs % cluster, 16) != 0) {
+				printf("FAIL seek %s to %u: %d\r\n", mode ? "map" : "chain", (DWORD)ofs, fr);
+				failures++;
+				break;
+			}
+		}
+		ns[mode] = SdEmu_Now() - start;
+		SdEmu_GetStats(&s1);
+		reads[mode] = s1.blocksRead - s0.blocksRead;
+	}
+	printf("seek,200,chain_reads,%llu,chain_us,%llu,map_reads,%llu,map_us,%llu,fragments,%u\r\n",
+			(unsigned long long)reads[0], (unsigned long long)(ns[0] / 1000),
+			(unsigned long long)reads[1], (unsigned long long)(ns[1] / 1000), SeekMap_Fragments(&map));
+
+	// Grow the file through the same FIL; the next seek extends the map from its last fragment
+	FSIZE_t oldSize = f_size(&a);
+	uint32_t before = SeekMap_Fragments(&map);
+	if (Host_Interleave(fs, &a, &b, 2) != 0) return failures + 1;
+	FSIZE_t ofs = oldSize + cluster + 100;
+	FRESULT fr = SeekMap_Seek(&map, ofs);
+	if (fr == FR_OK) fr = f_read(&a, check, 16, &br);
+	Host_Fill(pattern, 116, (uint32_t)(oldSize + cluster));
+	if (fr != FR_OK || memcmp(check, pattern + 100, 16) != 0 || SeekMap_Fragments(&map) != before + 2) {
+		printf("FAIL seek map extension: %d, %u -> %u fragments\r\n", fr, before, SeekMap_Fragments(&map));
+		failures++;
+	}
+
+	f_close(&b);
+	f_close(&a);
+	return failures;
+}
+
+// Pushes 64 byte records through the logger in either mode, then reads the file back
+static int Host_Logger(int contiguous) {
+	const char* path = contiguous ? "LOGDIR/RAW.LOG" : "LOGDIR/FAT.LOG";
+	const UINT total = 1 << 20;
+	FRESULT fr;
+	FIL file;
+	UINT br;
+
+	Host_Fill(pattern, sizeof(pattern), 64);
+	if (contiguous) {
+		fr = Log_OpenContiguous(path, 4 << 20);
+	} else {
+		f_unlink(path);																		// Log_Open appends
+		fr = Log_Open(path);
+	}
+	if (fr != FR_OK) {
+		printf("FAIL log open %s: %d\r\n", path, fr);
+		return 1;
+	}
+
+	uint64_t start = SdEmu_Now();
+	for (UINT done = 0; done < total; done += 64) {
+		Log_Push(pattern + done % sizeof(pattern), 64);
+		if (Log_Pending() >= LOG_RING_SIZE / 2) Log_Service();
+		if (done % (256 * 1024) == 100 * 64) Log_Flush();									// Partial sectors mid stream
+	}
+	fr = Log_Close();
+	uint64_t ns = SdEmu_Now() - start;
+
+	int failures = 0;
+	if (fr == FR_OK) fr = f_open(&file, path, FA_READ);
+	if (fr != FR_OK || f_size(&file) != total) {
+		printf("FAIL log %s: %d, size %u\r\n", path, fr, fr == FR_OK ? (DWORD)f_size(&file) : 0);
+		failures++;
+	} else {
+		for (UINT done = 0; done < total && !failures; done += sizeof(check)) {
+			if (f_read(&file, check, sizeof(check), &br) != FR_OK || br != sizeof(check)) failures++;
+			for (UINT i = 0; i < br && !failures; i += 64) {
+				if (memcmp(check + i, pattern + (done + i) % sizeof(pattern), 64) != 0) failures++;
+			}
+		}
+		if (failures) printf("FAIL log %s content\r\n", path);
+	}
+	f_close(&file);
+
+	printf("log,%s,kBps,%llu\r\n", contiguous ? "contiguous" : "f_write",
+			(unsigned long long)((uint64_t)total * 1000 / (ns / 1000 + 1)));
+	return failures;
+}
+
+static const Rec_Channel hostChannels[] = {
+	{ "adc", "mV", REC_U16 },
+	{ "accel_z", "mg", REC_I16 },
+	{ "temp", "C", REC_F32 }
+};
+
+typedef struct {
+	uint32_t records;
+	uint32_t errors;
+} Host_Check;
+
+// Record n: timestamp 1000 * n + n % 7, channel n % 3, value derived from n
+static void Host_RecordValue(uint32_t n, uint8_t* value) {
+	uint16_t adc = n * 3;
+	int16_t accel = -(int16_t)n;
+	float temp = 20.0f + n / 1000.0f;
+
+	switch (n % 3) {
+		case 0: memcpy(value, &adc, 2); break;
+		case 1: memcpy(value, &accel, 2); break;
+		case 2: memcpy(value, &temp, 4); break;
+	}
+}
+
+static void Host_CheckRecord(void* ctx, uint32_t timestamp, uint8_t channel, const uint8_t* value) {
+	Host_Check* c = ctx;
+	uint32_t n = c -> records++;
+	uint8_t expect[4];
+
+	Host_RecordValue(n, expect);
+	if (timestamp != 1000 * n + n % 7 || channel != n % 3 || memcmp(value, expect, recTypeSize[hostChannels[channel].type]) != 0) {
+		c -> errors++;
+	}
+}
+
+// Copies a file from the image to the host as it is on the card
+static void Host_Export(const char* path, const char* dest) {
+	FIL file;
+	UINT br;
+	FILE* out = fopen(dest, "wb");
+
+	if (!out) return;
+	if (f_open(&file, path, FA_READ) == FR_OK) {
+		while (f_read(&file, check, sizeof(check), &br) == FR_OK && br > 0) fwrite(check, 1, br, out);
+		f_close(&file);
+	}
+	fclose(out);
+}
+
+// Reads a whole log and expands LZ frames, giving the byte stream the logger was fed; caller frees
+static uint8_t* Host_ReadStream(const char* path, uint32_t* length) {
+	FIL file;
+	UINT br;
+
+	if (f_open(&file, path, FA_READ) != FR_OK) return NULL;
+	uint32_t size = f_size(&file);
+	uint8_t* raw = malloc(size);
+	uint8_t* stream = malloc(size * 8 + 1);													// Frames expand at most LOG_CHUNK_SIZE / 512 times
+	if (f_read(&file, raw, size, &br) != FR_OK || br != size) size = 0;
+	f_close(&file);
+
+	uint32_t at = 0, out = 0, sectors;
+	while (at < size) {
+		int32_t n = LZ_Unframe(&raw[at], size - at, &stream[out], 65535, &sectors);
+		if (n < 0) break;
+		if (n == 0) {																		// Plain sector
+			uint32_t part = size - at < 512 ? size - at : 512;
+			memcpy(&stream[out], &raw[at], part);
+			n = part;
+		}
+		out += n;
+		at += sectors * 512;
+	}
+
+	free(raw);
+	*length = out;
+	return stream;
+}
+
+// Encodes records through the logger into LOGDIR/REC.BIN, decodes them back; optionally exports the file
+// Flips one bit in the file at offset
+static int Host_Flip(const char* path, FSIZE_t offset) {
+	FIL file;
+	UINT bw;
+	uint8_t b;
+
+	if (f_open(&file, path, FA_READ | FA_WRITE) != FR_OK) return 1;
+	f_lseek(&file, offset);
+	f_read(&file, &b, 1, &bw);
+	b ^= 0x10;
+	f_lseek(&file, offset);
+	f_write(&file, &b, 1, &bw);
+	return f_close(&file) != FR_OK;
+}
+
+// LogRead_Verify on an intact log, then with one bit flipped inside the third logical sector
+static int Host_ReadBack(const char* path, uint32_t blocks) {
+	LogRead_Report report;
+	int failures = 0;
+
+	if (LogRead_Verify(path, &report) != FR_OK || !report.header || report.blocks != blocks || report.bad || report.gaps || report.badFrames) {
+		printf("FAIL readback %s: %u of %u blocks, %u bad, %u gaps\r\n", path, report.blocks, blocks, report.bad, report.gaps);
+		failures++;
+	}
+
+	Host_Flip(path, 2 * 512 + 100);
+	if (LogRead_Verify(path, &report) != FR_OK || report.bad + report.badFrames == 0) {
+		printf("FAIL readback %s: flipped bit not detected\r\n", path);
+		failures++;
+	}
+	Host_Flip(path, 2 * 512 + 100);
+
+	printf("readback,%u,sectors,%u,frames,%u,corrupt_detected,%u\r\n", report.blocks, report.sectors, report.frames, report.bad + report.badFrames);
+	return failures;
+}
+
+static int Host_Records(uint32_t count, const char* export, uint8_t compress) {
+	static Rec_Encoder enc;
+	Rec_Schema hdr;
+	Host_Check check = { 0, 0 };
+	uint8_t value[4];
+	uint32_t seq, blocks = 0;
+	Log_Stats stats;
+
+	Log_SetCompression(compress);
+	if (Log_OpenContiguous("LOGDIR/REC.BIN", 4 << 20) != FR_OK) return 1;
+	uint64_t start = SdEmu_Now();
+	Rec_Begin(&enc, hostChannels, 3, 1000000, Log_Push);
+	Rec_WriteHeader(&enc);
+	for (uint32_t n = 0; n < count; n++) {
+		Host_RecordValue(n, value);
+		Rec_Add(&enc, 1000 * n + n % 7, n % 3, value);
+		if (Log_Pending() >= LOG_RING_SIZE / 2) Log_Service();
+	}
+	Rec_Flush(&enc);
+	FRESULT fr = Log_Close();
+	Log_GetStats(&stats);
+	uint64_t ns = SdEmu_Now() - start;
+	Log_SetCompression(0);
+	if (fr != FR_OK) return 1;
+
+	uint32_t length;
+	uint8_t* stream = Host_ReadStream("LOGDIR/REC.BIN", &length);
+	int failures = (!stream || length < 512 || Rec_ParseHeader(stream, &hdr) != 0);
+	for (uint32_t at = 512; !failures && at + 512 <= length; at += 512) {
+		if (Rec_CheckBlock(&stream[at], &seq) != 0 || seq != blocks++ || Rec_DecodeBlock(&hdr, &stream[at], Host_CheckRecord, &check) < 0) failures++;
+	}
+	free(stream);
+	if (!failures) failures += Host_ReadBack("LOGDIR/REC.BIN", blocks);
+	if (export) Host_Export("LOGDIR/REC.BIN", export);
+
+	if (failures || check.errors || check.records != count) {
+		printf("FAIL records: %u of %u decoded, %u mismatched\r\n", check.records, count, check.errors);
+		return 1;
+	}
+
+	uint32_t stored = compress ? stats.written : (blocks + 1) * 512;
+	printf("records,%u,%s,stored_bytes,%u,bytes_per_record,%u.%02u,effective_kBps,%llu", count,
+			compress ? "lz" : "plain", stored, stored / count, stored * 100 / count % 100,
+			(unsigned long long)((uint64_t)(blocks + 1) * 512 * 1000 / (ns / 1000 + 1)));
+	if (compress) {
+		printf(",ratio,%u.%02u,frames,%u,stored_raw,%u", stats.frameIn / stored, stats.frameIn * 100 / stored % 100,
+				stats.frames, stats.rawFrames);
+	}
+	printf("\r\n");
+	return 0;
+}
+
+// Host CPU cost of the codec on the record stream; the emulator clock only advances on the bus
+static void Host_CodecSpeed(void) {
+	static uint8_t in[LOG_CHUNK_SIZE], out[LOG_CHUNK_SIZE + LZ_FRAME_HDR], back[LOG_CHUNK_SIZE];
+	uint32_t length, sectors;
+	uint8_t* stream = Host_ReadStream("LOGDIR/REC.BIN", &length);
+
+	if (!stream || length < sizeof(in)) return;
+	memcpy(in, stream + 512, sizeof(in) - LZ_FRAME_HDR);
+	free(stream);
+
+	clock_t c0 = clock();
+	uint16_t size = 0;
+	for (int i = 0; i < 1000; i++) size = LZ_Frame(in, sizeof(in) - LZ_FRAME_HDR, out);
+	clock_t c1 = clock();
+	for (int i = 0; i < 1000; i++) LZ_Unframe(out, size, back, sizeof(back), &sectors);
+	clock_t c2 = clock();
+
+	printf("lz,host_ns_per_byte,compress,%.2f,decompress,%.2f\r\n",
+			(c1 - c0) * 1e9 / CLOCKS_PER_SEC / 1000 / (sizeof(in) - LZ_FRAME_HDR),
+			(c2 - c1) * 1e9 / CLOCKS_PER_SEC / 1000 / (sizeof(in) - LZ_FRAME_HDR));
+}
+
+// The volume Vol_Format laid out: capacity from the CSD, everything on the AU from ACMD13
+static int Host_Layout(FATFS* fs, const SdEmu_Config* config) {
+	static const DWORD auSectors[16] = { 0, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 24576, 32768, 49152, 65536, 131072 };
+	Vol_Layout layout;
+	int failures = 0;
+
+	if (Vol_GetLayout(fs, &layout) != FR_OK) return 1;
+	printf("layout,fs_type,%u,sectors,%u,au,%u,cluster,%u,base,%u,fat,%u,data,%u,%s\r\n", fs -> fs_type, (DWORD)layout.sectors,
+			layout.block, layout.cluster, (DWORD)layout.base, (DWORD)layout.fat, (DWORD)layout.data, layout.aligned ? "aligned" : "misaligned");
+
+	DWORD au = auSectors[config -> auSize & 15];
+	DWORD block = 1;
+	while (block * 2 <= au && au % (block * 2) == 0 && block < 0x8000) block *= 2;
+	if (!layout.aligned || layout.block != block) {
+		printf("FAIL layout not on the %u sector AU\r\n", block);
+		failures++;
+	}
+	DWORD ceiling = (fs -> fs_type == FS_EXFAT) ? VOL_EXFAT_CLUSTER_MAX : VOL_CLUSTER_MAX;
+	if ((fs -> fs_type == FS_EXFAT) != (layout.sectors > VOL_EXFAT_SECTORS)) {
+		printf("FAIL layout file system type %u for %u sectors\r\n", fs -> fs_type, (DWORD)layout.sectors);
+		failures++;
+	}
+	if (layout.cluster > ceiling || (block > 1 && layout.cluster > block * FF_MAX_SS)) {
+		printf("FAIL layout cluster %u\r\n", layout.cluster);
+		failures++;
+	}
+
+	uint8_t csd[16] = { 0x40 };																// CSD 2.0 with the largest C_SIZE, a 2 TB card
+	csd[7] = 0x3F;
+	csd[8] = 0xFF;
+	csd[9] = 0xFF;
+	if (SD_CSDSectors(csd) != (1ULL << 32)) {
+		printf("FAIL CSD capacity %llu sectors for C_SIZE 0x3FFFFF\r\n", (unsigned long long)SD_CSDSectors(csd));
+		failures++;
+	}
+	return failures;
+}
+
+// fmt.c against libc on the specifiers the firmware uses, plus the cost per formatted line
+static int Host_Format(void) {
+	static char longText[] = "truncated to the buffer size: 0123456789012345678901234567890123456789";	// Not const, so the compiler does not flag the truncation
+	char mine[64], libc[64];
+	int failures = 0;
+
+#define HOST_FMT_CHECK(...)																	\
+	do {																					\
+		int a = Fmt_Snprintf(mine, sizeof(mine), __VA_ARGS__);								\
+		int b = snprintf(libc, sizeof(libc), __VA_ARGS__);									\
+		if (a != b || strcmp(mine, libc) != 0) {											\
+			printf("FAIL fmt \"%s\" != \"%s\"\r\n", mine, libc);						\
+			failures++;																		\
+		}																					\
+	} while (0)
+
+	HOST_FMT_CHECK("%d|%i|%u", -12345, 0, 4000000000U);
+	HOST_FMT_CHECK("%lu,%ld", 4294967295UL, -2147483647L - 1);
+	HOST_FMT_CHECK("%llu %lld", 18446744073709551615ULL, -9223372036854775807LL - 1);
+	HOST_FMT_CHECK("0x%02X %x %08x", 7, 0xDEADBEEFU, 0xABCU);
+	HOST_FMT_CHECK("FILL%03d.BIN %5d|%-5d|%05d", 7, -42, 42, -42);
+	HOST_FMT_CHECK("%s,%-8s|%8s|%c%%", "probe", "ab", "cd", 'x');
+	HOST_FMT_CHECK("%s", longText);
+#undef HOST_FMT_CHECK
+
+	clock_t c0 = clock();
+	for (int i = 0; i < 100000; i++) Fmt_Snprintf(mine, sizeof(mine), "seq_write,%lu,%lu,%lu,kB/s\r\n", (unsigned long)i, 1048576UL, 715UL);
+	clock_t c1 = clock();
+	for (int i = 0; i < 100000; i++) snprintf(libc, sizeof(libc), "seq_write,%lu,%lu,%lu,kB/s\r\n", (unsigned long)i, 1048576UL, 715UL);
+	clock_t c2 = clock();
+
+	printf("fmt,host_ns_per_line,fmt,%.0f,libc,%.0f\r\n",
+			(c1 - c0) * 1e9 / CLOCKS_PER_SEC / 100000, (c2 - c1) * 1e9 / CLOCKS_PER_SEC / 100000);
+	return failures;
+}
+
+// The sync scheduler on a plain f_write log: sync every chunk, the defaults, and a cost target low
+// enough that the back-off has to kick in
+static void Host_SyncPolicy(void) {
+	static const struct {
+		const char* name;
+		Log_SyncPolicy policy;
+	} runs[] = {
+		{ "every_chunk", { LOG_CHUNK_SIZE, 60000, 0, 0, LOG_RING_SIZE + 1, 1000, 1 } },
+		{ "default", { LOG_SYNC_BYTES, LOG_SYNC_MS, LOG_SYNC_GRACE_MS, LOG_SYNC_IDLE, LOG_SYNC_PRESSURE, LOG_SYNC_COST_MS, LOG_SYNC_MAX_SCALE } },
+		{ "backoff", { 32768, LOG_SYNC_MS, LOG_SYNC_GRACE_MS, LOG_SYNC_IDLE, LOG_SYNC_PRESSURE, 1, LOG_SYNC_MAX_SCALE } }
+	};
+	const UINT total = 2 << 20;
+	Log_Stats stats;
+
+	Host_Fill(pattern, sizeof(pattern), 22);
+	for (unsigned r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		f_unlink("LOGDIR/SYNC.LOG");
+		if (Log_Open("LOGDIR/SYNC.LOG") != FR_OK) return;
+		Log_SetSyncPolicy(&runs[r].policy);
+
+		uint64_t start = SdEmu_Now();
+		for (UINT done = 0; done < total; done += 64) {
+			Log_Push(pattern + done % sizeof(pattern), 64);
+			if (Log_Pending() >= LOG_CHUNK_SIZE) Log_Service();
+		}
+		Log_GetStats(&stats);
+		Log_Close();
+		uint64_t ns = SdEmu_Now() - start;
+
+		printf("sync,%s,kBps,%llu,syncs,%u,deferred,%u,mean_ms,%u,max_ms,%u,scale,%u\r\n", runs[r].name,
+				(unsigned long long)((uint64_t)total * 1000 / (ns / 1000 + 1)), stats.commits, stats.syncDeferred,
+				stats.commits ? stats.syncMsTotal / stats.commits : 0, stats.syncMsMax, stats.syncScale);
+	}
+	Log_SetSyncPolicy(&runs[1].policy);
+}
+
+// Journal mode across simulated power cuts: the remount drops the open FIL and any dirty cache lines,
+// so only what reached the card survives. Recovery must find exactly the sectors written after the last
+// commit, and none of the stale sectors a previous journal left in the same clusters.
+static int Host_Journal(FATFS* fs) {
+	static Rec_Encoder enc;
+	const char* path = "LOGDIR/J.JNL";
+	Log_Recovery rec;
+	LogRead_Report report;
+	Log_Stats stats;
+	uint8_t value[4];
+	int failures = 0;
+
+	Log_SetSeal(1);																			// Sealed by the writer, as on the board
+	for (int run = 0; run < 2; run++) {
+		uint32_t count = run ? 3000 : 60000;												// The second run stays inside the first one's sectors
+
+		if (Log_OpenJournal(path, 4 << 20) != FR_OK) return failures + 1;
+		Rec_Begin(&enc, hostChannels, 3, 1000000, Log_Push);
+		Rec_DeferSeal(&enc);
+		Rec_WriteHeader(&enc);
+		for (uint32_t n = 0; n < count; n++) {
+			Host_RecordValue(n, value);
+			Rec_Add(&enc, 1000 * n + n % 7, n % 3, value);
+			if (Log_Pending() >= LOG_RING_SIZE / 2) Log_Service();
+			if (n == count / 3) Log_Flush();
+		}
+		Log_Service();
+		Log_GetStats(&stats);
+		uint32_t sectors = stats.written / 512;
+		uint32_t payload = (enc.seq + 1) * 512 - Log_Pending();
+
+		f_mount(fs, "", 1);																	// Power cut
+		FRESULT fr = Log_RecoverJournal(path, &rec);
+		if (fr != FR_OK || rec.committed + rec.recovered != sectors || rec.recovered == 0) {
+			printf("FAIL journal run %d: %d, committed %u + recovered %u of %u sectors\r\n", run, fr, rec.committed, rec.recovered, sectors);
+			failures++;
+		}
+
+		fr = LogRead_Verify(path, &report);
+		if (fr != FR_OK || !report.header || report.bad || report.gaps || report.badFrames || report.blocks != payload / 512 - 1) {
+			printf("FAIL journal run %d readback: %u of %u blocks, %u bad, %u gaps\r\n", run, report.blocks, payload / 512 - 1, report.bad, report.gaps);
+			failures++;
+		}
+		printf("journal,run,%d,sectors,%u,committed,%u,recovered,%u,blocks,%u,commits,%u\r\n",
+				run, sectors, rec.committed, rec.recovered, report.blocks, stats.commits);
+	}
+	Log_SetSeal(0);
+
+	if (Log_OpenJournal(path, 1 << 20) != FR_OK) return failures + 1;					// Clean close: nothing left to recover
+	Log_Push(pattern, 1000);
+	Log_Close();
+	if (Log_RecoverJournal(path, &rec) != FR_OK || rec.recovered != 0 || rec.committed != 3) {
+		printf("FAIL journal close: committed %u, recovered %u\r\n", rec.committed, rec.recovered);
+		failures++;
+	}
+
+	DWORD before, after;																	// Cut right after a commit: the tail must still come back
+	FATFS* volume;
+	f_unlink(path);
+	if (f_getfree("", &before, &volume) != FR_OK) return failures + 1;
+	if (Log_OpenJournal(path, 4 << 20) != FR_OK) return failures + 1;
+	Log_Push(pattern, 5000);
+	Log_Flush();
+	f_mount(fs, "", 1);
+	FRESULT fr = Log_RecoverJournal(path, &rec);
+	DWORD used = (rec.committed + fs -> csize - 1) / fs -> csize;
+	if (fr != FR_OK || rec.recovered != 0 || f_getfree("", &after, &volume) != FR_OK || after + used != before) {
+		printf("FAIL journal commit cut: %d, committed %u, %u of %u clusters free\r\n", fr, rec.committed, after, before - used);
+		failures++;
+	}
+
+	return failures;
+}
+
+// A full extent rotated the way main does it: Log_Suspend keeps the ring, so what was pending carries over
+// into the next journal behind a new header and the two files together hold every block
+static int Host_Rotate() {
+	static Rec_Encoder enc;
+	static uint8_t header[REC_BLOCK_SIZE];
+	const char* path = "LOGDIR/J.JNL";
+	const char* archive = "LOGDIR/J0001.JNL";
+	LogRead_Report first, report;
+	Log_Stats stats;
+	uint8_t value[4];
+	uint8_t rotated = 0;
+	FRESULT fr = FR_OK;
+	int failures = 0;
+
+	f_unlink(archive);
+	Log_SetSeal(1);
+	if (Log_OpenJournal(path, 64 << 10) != FR_OK) return failures + 1;
+	Rec_Begin(&enc, hostChannels, 3, 1000000, Log_Push);
+	Rec_DeferSeal(&enc);
+	Rec_WriteHeader(&enc);
+	for (uint32_t n = 0; fr == FR_OK && n < 40000; n++) {
+		Host_RecordValue(n, value);
+		Rec_Add(&enc, 1000 * n, n % 3, value);
+		if (Log_Pending() < LOG_RING_SIZE / 2) continue;
+		fr = Log_Service();
+		if (fr == FR_DENIED && !rotated) {
+			rotated = 1;
+			Log_Suspend();
+			f_rename(path, archive);
+			fr = Log_OpenJournal(path, 1 << 20);
+			Rec_BuildHeader(&enc, header);
+			Rec_Seal(header);
+			if (fr == FR_OK) fr = Log_WriteHeader(header, sizeof(header));
+		}
+	}
+	Rec_Flush(&enc);
+	Log_GetStats(&stats);
+	if (fr == FR_OK) fr = Log_Close();
+	Log_SetSeal(0);
+	if (fr == FR_OK) fr = LogRead_Verify(archive, &first);
+	if (fr == FR_OK) fr = LogRead_Verify(path, &report);
+	if (fr != FR_OK || !rotated || stats.drops || !first.header || !report.header || first.bad || report.bad
+			|| first.gaps || report.gaps || first.blocks + report.blocks != enc.seq) {
+		printf("FAIL journal rotate: %d, %u drops, %u + %u of %u blocks, %u + %u gaps\r\n", fr, stats.drops,
+				first.blocks, report.blocks, enc.seq, first.gaps, report.gaps);
+		failures++;
+	}
+	printf("journal,rotate,blocks,%u,%u\r\n", first.blocks, report.blocks);
+
+	return failures;
+}
+
+static Rec_Encoder spillEnc;
+static uint64_t spillNextNs;
+static uint32_t spillCount;
+
+#define HOST_SPILL_PERIOD_NS	30000														// One record every 30 us, about 150 kB/s
+
+// Timer interrupt stand-in on the emulator clock; runs inside SPI transfers and flash programming too
+static void Host_SpillProducer(uint64_t now) {
+	uint8_t value[4];
+
+	while (spillNextNs <= now) {
+		Host_RecordValue(spillCount, value);
+		Rec_Add(&spillEnc, (uint32_t)(spillNextNs / 1000), spillCount % 3, value);
+		spillCount++;
+		spillNextNs += HOST_SPILL_PERIOD_NS;
+	}
+}
+
+// Garbage collection stalls against a steady producer: every 32nd write command leaves the card busy
+// for 200 ms, inside the 500 ms the driver allows but almost twice as long as the ring lasts. Without the spill area blocks are lost; with it none may be.
+static int Host_Spill(const SdEmu_Config* base) {
+	const char* path = "LOGDIR/SPILL.LOG";
+	SdEmu_Config config = *base;
+	SdEmu_Stats emu;
+	LogRead_Report report;
+	Log_Stats stats;
+	int failures = 0;
+
+	config.gcEvery = 32;
+	config.gcUs = 200000;
+	for (int spill = 0; spill < 2; spill++) {
+		f_unlink(path);
+		Log_SetSpill(spill);
+		Log_SetSeal(1);
+		if (Log_Open(path) != FR_OK) return failures + 1;									// Erases the area the first time
+		Rec_Begin(&spillEnc, hostChannels, 3, 1000000, Log_Push);
+		Rec_DeferSeal(&spillEnc);															// The producer hook stands in for a handler
+		Rec_WriteHeader(&spillEnc);
+
+		SdEmu_GetStats(&emu);
+		uint64_t stalls = emu.gcStalls;
+		uint64_t start = SdEmu_Now();
+		spillNextNs = start;
+		spillCount = 0;
+		SdEmu_SetConfig(&config);
+		SdEmu_SetHook(Host_SpillProducer);
+		while (SdEmu_Now() - start < 2000000000ULL) {
+			Log_Service();
+			SdEmu_Advance(10000);															// The rest of the main loop
+		}
+		SdEmu_SetHook(NULL);
+		SdEmu_SetConfig(base);
+		SdEmu_GetStats(&emu);
+		uint64_t ns = SdEmu_Now() - start;
+
+		Rec_Flush(&spillEnc);
+		Log_GetStats(&stats);
+		FRESULT fr = Log_Close();
+		if (fr == FR_OK) fr = LogRead_Verify(path, &report);
+
+		uint32_t produced = spillEnc.seq * 512;
+		printf("spill,%s,kBps,%u,stalls,%llu,drops,%u,spilled,%u,spill_max,%u,full,%u,blocks,%u,gaps,%u\r\n",
+				spill ? "on" : "off", (uint32_t)((uint64_t)produced * 1000000 / ns),
+				(unsigned long long)(emu.gcStalls - stalls), stats.drops, stats.spilled, stats.spillMax, stats.spillFull,
+				report.blocks, report.gaps);
+
+		if (fr != FR_OK || report.bad || !report.header) {
+			printf("FAIL spill %d: %d, %u bad\r\n", spill, fr, report.bad);
+			failures++;
+		} else if (spill && (stats.drops || report.gaps || report.blocks != spillEnc.seq || stats.spilled == 0)) {
+			printf("FAIL spill: %u drops, %u gaps, %u of %u blocks\r\n", stats.drops, report.gaps, report.blocks, spillEnc.seq);
+			failures++;
+		} else if (!spill && stats.drops == 0) {
+			printf("FAIL spill: the stalls never overflowed the ring\r\n");
+			failures++;
+		}
+	}
+
+	// A long run reclaims the area: once it is past LOG_SPILL_RECLAIM and drained, Log_Service erases it
+	const char* longPath = "LOGDIR/RECLAIM.LOG";
+	FILINFO info;
+	uint32_t pushed = 0;
+	f_unlink(longPath);
+	Log_SetSeal(0);
+	if (Log_Open(longPath) != FR_OK) return failures + 1;
+	config.gcEvery = 2;
+	SdEmu_SetConfig(&config);
+	while (pushed < 4 * SPILL_SIZE) {
+		while (Log_Pending() < LOG_SPILL_HIGH + 1024 && pushed < 4 * SPILL_SIZE) {
+			Log_Push(pattern + pushed % 4096, 512);
+			pushed += 512;
+		}
+		Log_Service();
+		SdEmu_Advance(10000000);
+	}
+	SdEmu_SetConfig(base);
+	for (int n = 0; n < 100; n++) {
+		Log_Service();
+		SdEmu_Advance(10000000);
+	}
+	Log_GetStats(&stats);
+	FRESULT fr = Log_Close();
+	if (fr == FR_OK) fr = f_stat(longPath, &info);
+	printf("spill,reclaim,spilled,%u,spill_max,%u,erases,%u,drops,%u\r\n", stats.spilled, stats.spillMax, stats.spillErases, stats.drops);
+	if (fr != FR_OK || stats.spilled <= SPILL_SIZE || stats.spillErases < 2 || stats.spillFull || stats.drops || info.fsize != pushed) {
+		printf("FAIL spill reclaim: %d, %u spilled, %u erases, %u full, %u drops\r\n", fr, stats.spilled, stats.spillErases, stats.spillFull, stats.drops);
+		failures++;
+	}
+
+	Log_SetSpill(0);
+	Log_SetSeal(0);
+
+	return failures;
+}
+
+static void Host_Usage(const char* name) {
+	printf("usage: %s [-i image] [-s MiB] [-b busy_us] [-l latency_us] [-a au_code] [-x export.bin] [-q]\r\n", name);
+}
+
+int main(int argc, char** argv) {
+	const char* path = "sdcard.img";
+	const char* export = NULL;
+	uint64_t sizeMiB = 4096;
+	int quick = 0;
+	SdEmu_Config config;
+	FATFS fs;
+	FRESULT fr;
+	int opt, failures = 0;
+
+	SdEmu_DefaultConfig(&config);
+	while ((opt = getopt(argc, argv, "i:s:b:l:a:x:q")) != -1) {
+		switch (opt) {
+			case 'i': path = optarg; break;
+			case 's': sizeMiB = strtoull(optarg, NULL, 0); break;
+			case 'b': config.busyUs = strtoul(optarg, NULL, 0); break;
+			case 'l': config.readLatencyUs = strtoul(optarg, NULL, 0); break;
+			case 'a': config.auSize = strtoul(optarg, NULL, 0); break;
+			case 'x': export = optarg; break;
+			case 'q': quick = 1; break;
+			default: Host_Usage(argv[0]); return 2;
+		}
+	}
+
+	if (SdEmu_Open(path, sizeMiB << 20, &config) != 0) {
+		perror(path);
+		return 2;
+	}
+
+	Prof_Init();
+	SPI_Init();
+	SPI_DMA_Init();
+
+	fr = f_mount(&fs, "", 1);
+	if (fr == FR_NO_FILESYSTEM) {
+		printf("Formatting %s\r\n", path);
+		fr = Vol_Format("", work, sizeof(work));
+		if (fr == FR_OK) fr = f_mount(&fs, "", 1);
+	}
+	if (fr != FR_OK) {
+		printf("Mount failed: %d\r\n", fr);
+		SdEmu_Close();
+		return 1;
+	}
+	printf("Mount successful\r\n");
+
+	FATFS* volume;
+	DWORD freeClusters;
+	if (f_getfree("", &freeClusters, &volume) == FR_OK) {								// Also builds the free cluster map
+		printf("%u free clusters of %u sectors\r\n", freeClusters, (DWORD)volume -> csize);
+	}
+
+	failures += Host_Layout(&fs, &config);
+	failures += Host_Format();
+	f_mkdir("LOGDIR");
+	failures += Host_RoundTrip("LOGDIR/TINY.TXT", 11, 11);
+	failures += Host_RoundTrip("LOGDIR/ONE.BIN", 512, 512);
+	failures += Host_RoundTrip("LOGDIR/ODD.BIN", 3001, 97);
+	failures += Host_RoundTrip("LOGDIR/MULTI.BIN", 65536, 65536);
+	failures += Host_RoundTrip("LOGDIR/MIXED.BIN", 40000, 4096);
+	failures += Host_Fragment();
+	failures += Host_Seek(volume);
+	failures += Host_Records(20000, NULL, 0);
+	failures += Host_Records(20000, export, 1);
+	Host_CodecSpeed();
+	failures += Host_Logger(0);
+	failures += Host_Logger(1);
+	failures += Host_Journal(&fs);
+	Host_SyncPolicy();
+	failures += Host_Spill(&config);
+	failures += Host_Rotate();
+
+	if (!quick) {
+		Prof_Reset();
+		Host_Throughput(1 << 20, 512);
+		Host_Throughput(1 << 20, 4096);
+		Host_Throughput(1 << 20, 32768);
+		Host_Append(1 << 20, 64, 64);
+		Host_Append(1 << 20, 512, 4);
+		Prof_Dump();
+	}
+
+	f_mount(NULL, "", 0);
+
+	SdEmu_Stats stats;
+	SdEmu_GetStats(&stats);
+	printf("emu,commands,%llu,blocks_read,%llu,blocks_written,%llu,busy_bytes,%llu\r\n",
+			(unsigned long long)stats.commands, (unsigned long long)stats.blocksRead,
+			(unsigned long long)stats.blocksWritten, (unsigned long long)stats.busyBytes);
+	printf("%s: %d failure(s)\r\n", failures ? "FAIL" : "PASS", failures);
+
+	SdEmu_Close();
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+// spi.h on the host: every byte goes through the card emulator instead of SPI1
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "spi.h"
+#include "sd_emu.h"
+#include "console.h"
+
+#define HOST_PCLK2			90000000														// Same APB2 clock as Clock_Init on the board
+
+static uint8_t spiPrescaler = 7;
+
+void SPI_Init() {
+	spiPrescaler = 7;
+	SdEmu_SetClock(SPI_GetClock());
+	SdEmu_SetCS(1);
+}
+
+void SPI_DMA_Init() {
+}
+
+uint32_t SPI_SetClock(uint32_t maxHz) {
+	spiPrescaler = 0;
+	while (spiPrescaler < 7 && (HOST_PCLK2 >> (spiPrescaler + 1)) > maxHz) spiPrescaler++;
+
+	SdEmu_SetClock(SPI_GetClock());
+	return SPI_GetClock();
+}
+
+uint32_t SPI_SlowDown() {
+	if (spiPrescaler >= 7) return 0;
+
+	spiPrescaler++;
+	SdEmu_SetClock(SPI_GetClock());
+	return SPI_GetClock();
+}
+
+uint32_t SPI_GetClock() {
+	return HOST_PCLK2 >> (spiPrescaler + 1);
+}
+
+void SPI_Select() {
+	SdEmu_SetCS(0);
+}
+
+void SPI_Deselect() {
+	SdEmu_SetCS(1);
+}
+
+uint8_t SPI_Transfer(uint8_t data) {
+	return SdEmu_Exchange(data);
+}
+
+// The transfer completes inside Start; Wait only reports success
+void SPI_DMA_Start(const uint8_t* tx, uint8_t* rx, uint16_t len) {
+	for (uint16_t i = 0; i < len; i++) {
+		uint8_t in = SdEmu_Exchange(tx ? tx[i] : 0xFF);
+		if (rx) rx[i] = in;
+	}
+}
+
+uint8_t SPI_DMA_Wait() {
+	return 0;
+}
+
+uint32_t Host_Cycles() {
+	return (uint32_t)SdEmu_Now();
+}
+
+uint32_t HAL_GetTick() {
+	return (uint32_t)(SdEmu_Now() / 1000000);
+}
+
+// The console ring is stdout here
+int Console_Putc(int c) {
+	return putchar(c);
+}
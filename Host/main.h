@@ -0,0 +1,11 @@
+#ifndef __MAIN_H
+#define __MAIN_H
+
+// Host stand-in for the CubeMX main.h; only what the portable modules touch
+#include <stdint.h>
+
+#define __DMB()				__sync_synchronize()
+
+uint32_t HAL_GetTick(void);																	// Simulated milliseconds from the card emulator
+
+#endif
@@ -0,0 +1,138 @@
+// Streaming decoder for recfmt logs, plain, LZ framed or journaled: schema to stderr, records to stdout as CSV
+#include <stdio.h>
+#include <string.h>
+#include "recfmt.h"
+#include "lz.h"
+#include "logger.h"
+
+typedef struct {
+	const Rec_Schema* hdr;
+	double tick;
+} Dump_Context;
+
+static void Dump_Record(void* ctx, uint32_t timestamp, uint8_t channel, const uint8_t* v) {
+	Dump_Context* d = ctx;
+	const Rec_Channel* c = &d -> hdr -> channels[channel];
+	uint32_t u = v[0] | (v[1] << 8) | ((uint32_t)v[2] << 16) | ((uint32_t)v[3] << 24);		// Only the low bytes matter below
+	float f;
+
+	printf("%.6f,%.*s,", timestamp * d -> tick, REC_NAME_LEN, c -> name);
+	switch (c -> type) {
+		case REC_I8:  printf("%d\n", (int8_t)v[0]); break;
+		case REC_U8:  printf("%u\n", v[0]); break;
+		case REC_I16: printf("%d\n", (int16_t)(v[0] | (v[1] << 8))); break;
+		case REC_U16: printf("%u\n", (uint16_t)(v[0] | (v[1] << 8))); break;
+		case REC_I32: printf("%d\n", (int32_t)u); break;
+		case REC_U32: printf("%u\n", u); break;
+		case REC_F32: memcpy(&f, &u, 4); printf("%g\n", f); break;
+	}
+}
+
+// Logical sectors of the log: plain sectors pass through, LZ frames are expanded and re-cut into sectors
+typedef struct {
+	FILE* in;
+	uint8_t pending[65536 + REC_BLOCK_SIZE];
+	uint32_t have;
+	uint32_t used;
+	uint32_t badFrames;
+} Dump_Stream;
+
+static int Dump_Sector(Dump_Stream* s, uint8_t* sector) {
+	static uint8_t frame[65536];
+	uint32_t sectors;
+
+	while (s -> have - s -> used < REC_BLOCK_SIZE) {
+		memmove(s -> pending, &s -> pending[s -> used], s -> have - s -> used);
+		s -> have -= s -> used;
+		s -> used = 0;
+
+		if (fread(frame, 1, REC_BLOCK_SIZE, s -> in) != REC_BLOCK_SIZE) return 0;
+		uint16_t used = frame[2] | (frame[3] << 8);
+		if ((frame[0] | (frame[1] << 8)) == LOG_JOURNAL_MAGIC && used <= LOG_JOURNAL_DATA) {	// Journal sector; see Log_CheckJournal
+			uint32_t crc = frame[508] | (frame[509] << 8) | (frame[510] << 16) | ((uint32_t)frame[511] << 24);
+			if (crc == Rec_CRC32(frame, 508 / 4)) {
+				memcpy(&s -> pending[s -> have], &frame[LOG_JOURNAL_HDR], used);
+			} else {
+				fprintf(stderr, "damaged journal sector skipped\n");
+				s -> badFrames++;
+				memset(&s -> pending[s -> have], 0, used);
+			}
+			s -> have += used;
+			continue;
+		}
+		int32_t n = LZ_Unframe(frame, REC_BLOCK_SIZE, &s -> pending[s -> have], 65535, &sectors);
+		if (n == 0) {
+			memcpy(&s -> pending[s -> have], frame, REC_BLOCK_SIZE);
+			s -> have += REC_BLOCK_SIZE;
+			continue;
+		}
+		if (sectors > 1 && fread(&frame[REC_BLOCK_SIZE], 1, (sectors - 1) * REC_BLOCK_SIZE, s -> in) != (sectors - 1) * REC_BLOCK_SIZE) return 0;
+		n = LZ_Unframe(frame, sectors * REC_BLOCK_SIZE, &s -> pending[s -> have], 65535, &sectors);
+		if (n < 0) {																		// Zeros keep the blocks after it aligned
+			uint16_t length = frame[4] | (frame[5] << 8);
+			fprintf(stderr, "damaged LZ frame skipped\n");
+			s -> badFrames++;
+			memset(&s -> pending[s -> have], 0, length);
+			n = length;
+		}
+		s -> have += n;
+	}
+
+	memcpy(sector, &s -> pending[s -> used], REC_BLOCK_SIZE);
+	s -> used += REC_BLOCK_SIZE;
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	static Dump_Stream stream;
+	FILE* in = (argc > 1 && strcmp(argv[1], "-") != 0) ? fopen(argv[1], "rb") : stdin;
+	uint8_t sector[REC_BLOCK_SIZE];
+	Rec_Schema hdr;
+	uint32_t blocks = 0, bad = 0, gaps = 0, records = 0, seq, expect = 0;
+
+	if (!in) {
+		perror(argv[1]);
+		return 2;
+	}
+	stream.in = in;
+	if (!Dump_Sector(&stream, sector) || Rec_ParseHeader(sector, &hdr) != 0) {
+		fprintf(stderr, "not a recfmt log\n");
+		return 2;
+	}
+
+	fprintf(stderr, "# %u channels, %u ticks/s\n", hdr.count, hdr.tickHz);
+	for (int i = 0; i < hdr.count; i++) {
+		fprintf(stderr, "# %d %.*s [%.*s] type %u\n", i, REC_NAME_LEN, hdr.channels[i].name,
+				REC_UNIT_LEN, hdr.channels[i].unit, hdr.channels[i].type);
+	}
+
+	Dump_Context ctx = { &hdr, 1.0 / (hdr.tickHz ? hdr.tickHz : 1) };
+	printf("time_s,channel,value\n");
+	while (Dump_Sector(&stream, sector)) {
+		int check = Rec_CheckBlock(sector, &seq);
+		if (check == 1) continue;															// Unwritten or preallocated space
+		blocks++;
+		if (check != 0) {
+			fprintf(stderr, "block %u: CRC mismatch, skipped\n", seq);
+			bad++;
+			continue;
+		}
+		if (blocks > 1 && seq != expect) {
+			fprintf(stderr, "block %u: expected %u, %d missing\n", seq, expect, (int)(seq - expect));
+			gaps++;
+		}
+		expect = seq + 1;
+
+		int n = Rec_DecodeBlock(&hdr, sector, Dump_Record, &ctx);
+		if (n < 0) {
+			fprintf(stderr, "block %u: malformed payload\n", seq);
+			bad++;
+		} else {
+			records += n;
+		}
+	}
+
+	fprintf(stderr, "# %u blocks, %u records, %u bad, %u gaps\n", blocks, records, bad + stream.badFrames, gaps);
+	if (in != stdin) fclose(in);
+	return (bad || stream.badFrames) ? 1 : 0;
+}
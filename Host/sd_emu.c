@@ -0,0 +1,417 @@
+// Software model of an SDHC card in SPI mode, backed by a disk image file
+// Bytes go in and out one at a time through SdEmu_Exchange, exactly as SPI_Transfer moves them on the board.
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sd_emu.h"
+
+#define EMU_QUEUE_SIZE		1024
+
+typedef enum {
+	EMU_IDLE = 0,																			// Waiting for a command
+	EMU_READ_MULTI,																			// CMD18 streaming until CMD12
+	EMU_WRITE_TOKEN,																		// CMD24 waiting for 0xFE
+	EMU_WRITE_MULTI_TOKEN,																	// CMD25 waiting for 0xFC or 0xFD
+	EMU_WRITE_DATA																			// Collecting 512 data bytes and the CRC
+} Emu_State;
+
+static SdEmu_Config config;
+static SdEmu_Stats stats;
+static int image = -1;
+static uint64_t imageBlocks;
+
+static int selected;
+static uint32_t byteNs = 20000;																// 400 kHz until the driver raises the clock
+static uint64_t now;
+static uint64_t busyUntil;
+static uint64_t busyAfterQueue;																// Busy that starts once the queued response is out
+static uint64_t writeCommands;																// Completed CMD24 and CMD25, for the GC stalls
+static SdEmu_Hook hook;
+
+static Emu_State state;
+static uint8_t idle = 1;
+static uint8_t appCommand;
+static uint8_t initPolls;
+static uint8_t command[6];
+static uint8_t commandLength;
+static uint32_t blockAddress;
+static uint8_t multiWrite;
+static uint32_t multiWritten;
+static uint8_t block[514];
+static uint16_t blockLength;
+
+static uint8_t queue[EMU_QUEUE_SIZE];
+static uint16_t queueHead;
+static uint16_t queueTail;
+
+static uint16_t Emu_CRC16(const uint8_t* data, uint16_t length) {
+	uint16_t crc = 0;
+
+	for (uint16_t i = 0; i < length; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (int b = 0; b < 8; b++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+static void Emu_Push(uint8_t value) {
+	queue[queueHead] = value;
+	queueHead = (queueHead + 1) % EMU_QUEUE_SIZE;
+}
+
+static void Emu_Flush() {
+	queueHead = queueTail = 0;
+	busyAfterQueue = 0;
+}
+
+// Busy that ends a write command; every gcEvery-th one is a garbage collection stall instead
+static uint64_t Emu_WriteBusy(uint32_t us) {
+	if (config.gcEvery && ++writeCommands % config.gcEvery == 0) {
+		stats.gcStalls++;
+		us = config.gcUs;
+	}
+	return (uint64_t)us * 1000;
+}
+
+static void Emu_PushResponse(uint8_t r1) {
+	for (int i = 0; i < config.ncr; i++) Emu_Push(0xFF);
+	Emu_Push(r1);
+}
+
+// Start token, payload and CRC16, preceded by the configured access time
+static void Emu_PushDataBlock(const uint8_t* data, uint16_t length, uint32_t latencyUs) {
+	uint64_t latencyBytes = ((uint64_t)latencyUs * 1000) / byteNs;
+	if (latencyBytes > EMU_QUEUE_SIZE - length - 8) latencyBytes = EMU_QUEUE_SIZE - length - 8;
+
+	for (uint64_t i = 0; i < latencyBytes; i++) Emu_Push(0xFF);
+	Emu_Push(0xFE);
+	for (uint16_t i = 0; i < length; i++) Emu_Push(data[i]);
+
+	uint16_t crc = Emu_CRC16(data, length);
+	Emu_Push(crc >> 8);
+	Emu_Push(crc & 0xFF);
+}
+
+static int Emu_ReadImage(uint32_t address, uint8_t* data) {
+	if (address >= imageBlocks) return -1;
+	if (pread(image, data, 512, (off_t)address * 512) != 512) memset(data, 0, 512);
+	stats.blocksRead++;
+	return 0;
+}
+
+static int Emu_WriteImage(uint32_t address, const uint8_t* data) {
+	if (address >= imageBlocks) return -1;
+	if (pwrite(image, data, 512, (off_t)address * 512) != 512) return -1;
+	stats.blocksWritten++;
+	return 0;
+}
+
+// CSD version 2.0 for an SDHC/SDXC card of imageBlocks sectors
+static void Emu_BuildCSD(uint8_t* csd) {
+	uint32_t cSize = (uint32_t)(imageBlocks / 1024) - 1;
+
+	memset(csd, 0, 16);
+	csd[0] = 0x40;																			// CSD_STRUCTURE 1
+	csd[1] = 0x0E;																			// TAAC
+	csd[3] = config.tranSpeed;
+	csd[4] = 0x5B;																			// CCC
+	csd[5] = 0x59;																			// CCC, READ_BL_LEN 9
+	csd[7] = (cSize >> 16) & 0x3F;
+	csd[8] = (cSize >> 8) & 0xFF;
+	csd[9] = cSize & 0xFF;
+	csd[10] = 0x7F;																			// ERASE_BLK_EN, SECTOR_SIZE
+	csd[11] = 0x80;
+	csd[12] = 0x0A;																			// R2W_FACTOR, WRITE_BL_LEN 9
+	csd[13] = 0x40;
+	csd[15] = 0x01;
+}
+
+static void Emu_Command() {
+	uint8_t index = command[0] & 0x3F;
+	uint32_t arg = ((uint32_t)command[1] << 24) | ((uint32_t)command[2] << 16) | ((uint32_t)command[3] << 8) | command[4];
+	uint8_t app = appCommand;
+	uint8_t data[16];
+
+	stats.commands++;
+	appCommand = 0;
+	Emu_Flush();
+
+	if (state == EMU_READ_MULTI && index != 12) {
+		state = EMU_IDLE;
+	}
+
+	switch (app ? (0x80 | index) : index) {
+		case 0:
+			idle = 1;
+			initPolls = 0;
+			state = EMU_IDLE;
+			Emu_PushResponse(0x01);
+			break;
+
+		case 8:																				// R7 echoes the voltage and check pattern
+			Emu_PushResponse(idle);
+			Emu_Push(0x00);
+			Emu_Push(0x00);
+			Emu_Push(command[3] & 0x0F);
+			Emu_Push(command[4]);
+			break;
+
+		case 55:
+			appCommand = 1;
+			Emu_PushResponse(idle);
+			break;
+
+		case 0x80 | 41:
+			if (initPolls < config.initPolls) {
+				initPolls++;
+			} else {
+				idle = 0;
+			}
+			Emu_PushResponse(idle);
+			break;
+
+		case 58:																			// R3; powered up, CCS set
+			Emu_PushResponse(idle);
+			Emu_Push(0xC0);
+			Emu_Push(0xFF);
+			Emu_Push(0x80);
+			Emu_Push(0x00);
+			break;
+
+		case 9:
+			Emu_PushResponse(idle);
+			Emu_BuildCSD(data);
+			Emu_PushDataBlock(data, 16, 0);
+			break;
+
+		case 13:																			// R2
+			Emu_PushResponse(idle);
+			Emu_Push(0x00);
+			break;
+
+		case 12:
+			Emu_Push(0xFF);																	// Stuff byte
+			Emu_PushResponse(0x00);
+			busyAfterQueue = (uint64_t)config.stopBusyUs * 1000;
+			state = EMU_IDLE;
+			break;
+
+		case 17:
+		case 18:
+			if (arg >= imageBlocks) {
+				Emu_PushResponse(0x40);														// Parameter error
+				break;
+			}
+			Emu_PushResponse(0x00);
+			blockAddress = arg;
+			if (index == 17) {
+				uint8_t sector[512];
+				Emu_ReadImage(blockAddress, sector);
+				Emu_PushDataBlock(sector, 512, config.readLatencyUs);
+			} else {
+				state = EMU_READ_MULTI;														// Blocks are generated as the queue drains
+			}
+			break;
+
+		case 24:
+		case 25:
+			if (arg >= imageBlocks) {
+				Emu_PushResponse(0x40);
+				break;
+			}
+			Emu_PushResponse(0x00);
+			blockAddress = arg;
+			multiWrite = (index == 25);
+			multiWritten = 0;
+			state = multiWrite ? EMU_WRITE_MULTI_TOKEN : EMU_WRITE_TOKEN;
+			break;
+
+		case 0x80 | 23:																		// Pre-erase count is only a hint
+			Emu_PushResponse(0x00);
+			break;
+
+		case 0x80 | 13: {																	// R2, then the 64 byte SD_STATUS
+			uint8_t status[64];
+			memset(status, 0, sizeof(status));
+			status[8] = 0x04;																// SPEED_CLASS 10
+			status[10] = config.auSize << 4;
+			Emu_PushResponse(0x00);
+			Emu_Push(0x00);
+			Emu_PushDataBlock(status, sizeof(status), 0);
+			break;
+		}
+
+		case 0x80 | 22:																		// Well written blocks of the last multi block write
+			Emu_PushResponse(0x00);
+			data[0] = multiWritten >> 24;
+			data[1] = multiWritten >> 16;
+			data[2] = multiWritten >> 8;
+			data[3] = multiWritten;
+			Emu_PushDataBlock(data, 4, 0);
+			break;
+
+		default:
+			Emu_PushResponse(idle | 0x04);													// Illegal command
+			break;
+	}
+}
+
+static void Emu_Input(uint8_t mosi) {
+	switch (state) {
+		case EMU_WRITE_DATA:
+			block[blockLength++] = mosi;
+			if (blockLength < sizeof(block)) return;
+
+			if (Emu_WriteImage(blockAddress, block) == 0) {
+				Emu_Push(0xE5);																// Data accepted
+				busyAfterQueue = multiWrite ? (uint64_t)config.busyUs * 1000 : Emu_WriteBusy(config.busyUs);
+				blockAddress++;
+				multiWritten++;
+			} else {
+				Emu_Push(0xED);																// Write error
+			}
+			state = multiWrite ? EMU_WRITE_MULTI_TOKEN : EMU_IDLE;
+			return;
+
+		case EMU_WRITE_TOKEN:
+			if (mosi == 0xFE) {
+				state = EMU_WRITE_DATA;
+				blockLength = 0;
+				return;
+			}
+			break;
+
+		case EMU_WRITE_MULTI_TOKEN:
+			if (mosi == 0xFC) {
+				state = EMU_WRITE_DATA;
+				blockLength = 0;
+				return;
+			}
+			if (mosi == 0xFD) {
+				Emu_Push(0xFF);
+				busyAfterQueue = Emu_WriteBusy(config.stopBusyUs);
+				state = EMU_IDLE;
+				return;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	if (commandLength == 0 && (mosi & 0xC0) != 0x40) return;								// Not a start bit; filler
+
+	command[commandLength++] = mosi;
+	if (commandLength == sizeof(command)) {
+		commandLength = 0;
+		Emu_Command();
+	}
+}
+
+void SdEmu_DefaultConfig(SdEmu_Config* c) {
+	c -> busyUs = 500;
+	c -> readLatencyUs = 100;
+	c -> stopBusyUs = 200;
+	c -> ncr = 1;
+	c -> initPolls = 2;
+	c -> tranSpeed = 0x32;
+	c -> auSize = 9;
+	c -> gcEvery = 0;
+	c -> gcUs = 250000;
+}
+
+// Opens or creates a sparse image; size is only used when the file is shorter
+int SdEmu_Open(const char* path, uint64_t size, const SdEmu_Config* c) {
+	image = open(path, O_RDWR | O_CREAT, 0644);
+	if (image < 0) return -1;
+
+	off_t current = lseek(image, 0, SEEK_END);
+	if ((uint64_t)current < size && ftruncate(image, (off_t)size) != 0) return -1;
+	if ((uint64_t)current > size) size = current;
+
+	imageBlocks = size / 512;
+	config = *c;
+	memset(&stats, 0, sizeof(stats));
+	return 0;
+}
+
+void SdEmu_Close() {
+	if (image >= 0) close(image);
+	image = -1;
+}
+
+void SdEmu_SetCS(int level) {
+	selected = !level;
+	if (!selected) commandLength = 0;
+}
+
+// Timing changes apply from the next command on
+void SdEmu_SetConfig(const SdEmu_Config* c) {
+	config = *c;
+	writeCommands = 0;
+}
+
+void SdEmu_SetClock(uint32_t hz) {
+	byteNs = 8000000000ULL / hz;
+	if (byteNs == 0) byteNs = 1;
+}
+
+// The hook stands in for timer interrupts: it sees every step of the clock, inside transfers too
+void SdEmu_SetHook(SdEmu_Hook h) {
+	hook = h;
+}
+
+// Time spent away from the bus, such as flash programming or other work in the main loop
+void SdEmu_Advance(uint64_t ns) {
+	now += ns;
+	if (hook) hook(now);
+}
+
+uint64_t SdEmu_Now() {
+	return now;
+}
+
+void SdEmu_GetStats(SdEmu_Stats* out) {
+	*out = stats;
+}
+
+// One full duplex SPI byte
+uint8_t SdEmu_Exchange(uint8_t mosi) {
+	uint8_t miso = 0xFF;
+
+	now += byteNs;
+	stats.bytes++;
+	if (hook) hook(now);
+
+	if (!selected) return 0xFF;																// DO floats high behind the pull-up
+
+	if (now < busyUntil) {
+		stats.busyBytes++;
+		miso = 0x00;
+	} else if (queueHead != queueTail) {
+		miso = queue[queueTail];
+		queueTail = (queueTail + 1) % EMU_QUEUE_SIZE;
+		if (queueHead == queueTail && busyAfterQueue) {
+			busyUntil = now + busyAfterQueue;
+			busyAfterQueue = 0;
+		}
+	} else if (state == EMU_READ_MULTI) {
+		uint8_t sector[512];
+		if (Emu_ReadImage(blockAddress++, sector) == 0) {
+			Emu_PushDataBlock(sector, 512, config.readLatencyUs);
+		} else {
+			Emu_Push(0x08);																	// Data error token; out of range
+			state = EMU_IDLE;
+		}
+		miso = queue[queueTail];
+		queueTail = (queueTail + 1) % EMU_QUEUE_SIZE;
+	}
+
+	Emu_Input(mosi);
+	return miso;
+}
@@ -0,0 +1,42 @@
+#ifndef __SD_EMU_H
+#define __SD_EMU_H
+
+#include <stdint.h>
+
+// Timing knobs for the emulated card; all delays are in simulated time
+typedef struct {
+	uint32_t busyUs;																		// Programming busy after every written block
+	uint32_t readLatencyUs;																	// Access time before every data token
+	uint32_t stopBusyUs;																	// Busy after CMD12 and the stop token
+	uint8_t ncr;																			// 0xFF bytes before each response, 1 to 8
+	uint8_t initPolls;																		// ACMD41 calls answered with idle
+	uint8_t tranSpeed;																		// CSD TRAN_SPEED byte; 0x32 is 25 MHz
+	uint8_t auSize;																			// SD_STATUS AU_SIZE code; 9 is 4 MB, 0 undefined
+	uint32_t gcEvery;																		// Every nth write command ends in a garbage collection stall; 0 never
+	uint32_t gcUs;																			// Busy of such a stall instead of busyUs or stopBusyUs
+} SdEmu_Config;
+
+typedef struct {
+	uint64_t bytes;																			// SPI bytes clocked while selected or not
+	uint64_t commands;
+	uint64_t blocksRead;
+	uint64_t blocksWritten;
+	uint64_t busyBytes;																		// Bytes the host spent polling a busy card
+	uint64_t gcStalls;
+} SdEmu_Stats;
+
+typedef void (*SdEmu_Hook)(uint64_t);														// Called with the simulated time whenever it advances
+
+void SdEmu_DefaultConfig(SdEmu_Config*);
+int SdEmu_Open(const char*, uint64_t, const SdEmu_Config*);
+void SdEmu_Close(void);
+void SdEmu_SetCS(int);
+uint8_t SdEmu_Exchange(uint8_t);
+void SdEmu_SetConfig(const SdEmu_Config*);
+void SdEmu_SetClock(uint32_t);
+void SdEmu_SetHook(SdEmu_Hook);
+void SdEmu_Advance(uint64_t);
+uint64_t SdEmu_Now(void);
+void SdEmu_GetStats(SdEmu_Stats*);
+
+#endif